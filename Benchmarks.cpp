@@ -0,0 +1,59 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "ThreadPoolExecutor.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+// Measures how many tasks per second 'producers' threads can add to a pool
+// with 'shards' queues, and how long it takes until all of them have run.
+void benchSubmit(size_t producers, size_t shards, size_t tasks)
+{
+  std::atomic<size_t> done{ 0 };
+  double submitSeconds = 0;
+  Clock::time_point start;
+  {
+    Pledge::ThreadPoolExecutor pool(8, shards);
+    std::vector<std::thread> threads;
+    std::atomic<bool> go{ false };
+    size_t perProducer = tasks / producers;
+
+    for (size_t i = 0; i < producers; ++i) {
+      threads.emplace_back([&] {
+        while (!go)
+          std::this_thread::yield();
+        for (size_t j = 0; j < perProducer; ++j)
+          pool.add([&done] { done.fetch_add(1, std::memory_order_relaxed); });
+      });
+    }
+
+    start = Clock::now();
+    go = true;
+    for (std::thread& t : threads)
+      t.join();
+    submitSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+  }
+  double totalSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+  printf("%9zu %6zu %14.0f %14.0f\n",
+         producers,
+         shards,
+         done / submitSeconds,
+         done / totalSeconds);
+}
+
+int main(int argc, char* argv[])
+{
+  size_t tasks = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+
+  printf("%9s %6s %14s %14s\n", "producers", "shards", "submits/s", "tasks/s");
+  for (size_t producers = 1; producers <= 64; producers *= 2)
+    for (size_t shards : { 1, 8 })
+      benchSubmit(producers, shards, tasks);
+
+  return 0;
+}
@@ -1,19 +1,110 @@
 #pragma once
 
 #include <functional>
+#include <stdexcept>
+#include <thread>
+#include <vector>
 
 namespace Pledge {
 
+// Thrown by Future::get() if it would block an executor thread that uses
+// BlockingPolicy::Fail.
+class BlockingError : public std::logic_error
+{
+public:
+  using std::logic_error::logic_error;
+};
+
 // Executor defines an execution context for tasks. In practise it manages
 // when and in which thread then/error callbacks are called.
-class Executor
+//
+// The alignment leaves room for flags in the low bits of Executor pointers.
+class alignas(8) Executor
 {
 public:
   using Func = std::function<void()>;
 
+  // What Future::get() does when it needs to wait for a value in a thread
+  // that is running a task of this executor. Blocking the thread can
+  // deadlock the executor if the value is produced by a task waiting in the
+  // same executor.
+  enum class BlockingPolicy
+  {
+    // Block the thread until the value is ready
+    Block,
+    // Run queued tasks of this executor with tryRunOne() while waiting
+    Help,
+    // Throw BlockingError
+    Fail
+  };
+
   virtual ~Executor() {}
 
   virtual void add(Func func) = 0;
+
+  // Returns true if a task could be run directly in the calling thread
+  // instead of adding it to the executor. This is used to run continuations
+  // without a queue hop when a task in this executor completes a future
+  // whose continuations also run in this executor.
+  virtual bool canRunInline() const { return false; }
+
+  virtual BlockingPolicy blockingPolicy() const { return BlockingPolicy::Block; }
+
+  // Runs one queued task in the calling thread, if there is one. Returns
+  // false if there was nothing to run or the executor doesn't support this.
+  // The task must see this executor as current(), like any other of its tasks.
+  virtual bool tryRunOne() { return false; }
+
+  // Runs queued tasks in the calling thread until 'ready' returns true. Used
+  // by Future::get() with BlockingPolicy::Help, which calls wakeHelpers()
+  // after making 'ready' true. The default implementation can't sleep until
+  // a task is added, so it yields between the tries.
+  virtual void helpUntil(const std::function<bool()>& ready)
+  {
+    while (!ready())
+      if (!tryRunOne())
+        std::this_thread::yield();
+  }
+
+  // Wakes up the threads in helpUntil() to check their condition again
+  virtual void wakeHelpers() {}
+
+  // Returns the executor that is running a task in the current thread, or
+  // nullptr if the thread is not controlled by an executor.
+  static Executor* current() { return s_current; }
+
+  // Adds several tasks at once. The default implementation just calls add()
+  // for each task, executors should override this if they can schedule
+  // a batch cheaper than individual tasks.
+  virtual void addBatch(std::vector<Func> funcs)
+  {
+    for (Func& func : funcs)
+      add(std::move(func));
+  }
+
+protected:
+  // Executors should have this in scope while running tasks to update
+  // current()
+  class CurrentScope
+  {
+  public:
+    CurrentScope(Executor* executor)
+      : m_previous(s_current)
+    {
+      s_current = executor;
+    }
+
+    ~CurrentScope() { s_current = m_previous; }
+
+    CurrentScope(const CurrentScope&) = delete;
+    CurrentScope& operator=(const CurrentScope&) = delete;
+
+  private:
+    Executor* m_previous;
+  };
+
+private:
+  static inline thread_local Executor* s_current = nullptr;
 };
 
 }
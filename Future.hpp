@@ -1,12 +1,25 @@
 #pragma once
 
 #include <memory>
+#include <variant>
 
 #include "Executor.hpp"
 #include "details/FutureData.hpp"
 
 namespace Pledge {
 
+namespace Impl {
+struct FutureAccess;
+
+// Alternatives of Future::m_ready
+enum ReadyIndex : std::size_t
+{
+  ReadyNone,
+  ReadyValue,
+  ReadyError
+};
+}
+
 template <typename T>
 class Future
 {
@@ -22,7 +35,10 @@ public:
   Future(Future&&) = default;
   Future& operator=(Future&&) = default;
 
-  // Constructs a ready future.
+  // Constructs a ready future. A value of at most four pointers is stored
+  // in the future object itself, shared state is only allocated if an
+  // asynchronous continuation is added to it. Larger values are moved to
+  // shared state right away.
   template <typename Y>
   Future(Y&& t);
 
@@ -33,6 +49,10 @@ public:
   // the value or throws the future error. You can move the value out just
   // once, and the future must be rvalue when doing so. You can either add
   // continuations or call this function.
+  //
+  // If this is called from a thread that runs a task of an executor, the
+  // executor BlockingPolicy decides whether this blocks the thread, runs
+  // other tasks from the executor while waiting, or throws BlockingError.
   T get() &&;
 
   // Returns true if calling get() would return the value immediately.
@@ -49,11 +69,43 @@ public:
 
   // Add a continuation which is called from the current executor once
   // the future has a value. Returns a future with the same executor.
+  //
+  // The continuation can take the value by value, or by T& or const T& to
+  // use it in place without moving it out of the chain.
   template <typename F>
-  auto then(F&& f) && -> FutureType<typename Type<F>::Ret>;
+  auto then(F&& f) && -> FutureType<ThenRet<F, T>>;
+
+  // Like then(), but the continuation is called directly in the thread that
+  // completes this future, skipping the executor. Useful for cheap glue
+  // steps that aren't worth a queue hop. The returned future still has the
+  // same executor as this one.
+  template <typename F>
+  auto thenInline(F&& f) && -> FutureType<ThenRet<F, T>>;
+
+  // Like then(), but the continuation is called from 'executor'. Only this
+  // step is affected, the returned future has the same executor as this one.
+  template <typename F>
+  auto thenOn(Executor* executor, F&& f) && -> FutureType<ThenRet<F, T>>;
 
 protected:
+  friend class Future<void>;
+  friend struct Impl::FutureAccess;
+
+  template <typename Step, typename F>
+  auto thenStep(Step step, F&& f) && -> FutureType<ThenRet<F, T>>;
+
+  // Moves a ready value or error to a new shared state
+  void share();
+
+  // Only small ready values are kept in m_ready, so that a Future of a large
+  // type doesn't need room for the value. Errors are kept for any type.
+  static constexpr bool InlineReady = sizeof(T) <= 4 * sizeof(void*);
+  using ReadyValueType = std::conditional_t<InlineReady, T, void_type>;
+
   std::shared_ptr<FutureDataType<T>> m_data;
+  // Value or error of a ready future without shared state, and its executor
+  std::variant<std::monostate, ReadyValueType, std::exception_ptr> m_ready;
+  Executor* m_executor = nullptr;
 };
 
 // A special case for a void future. When continuing a void future, then()
@@ -65,19 +117,38 @@ class Future<void> : Future<void_type>
 public:
   using Base = Future<void_type>;
 
-  using Base::error;
   using Base::hasError;
   using Base::hasValue;
   using Base::isReady;
   using Base::then;
+  using Base::thenInline;
+  using Base::thenOn;
 
   Future(std::shared_ptr<FutureDataType<void>> data);
 
+  // Constructs a ready future without shared state.
+  Future(void_type);
+
   void get() && { std::move(*this).Base::get(); }
 
+  template <typename F>
+  auto error(F&& f) && -> Future<>;
+
   Future<>&& via(Executor* executor) &&;
+
+private:
+  friend struct Impl::FutureAccess;
+
+  Future(Base&& base);
 };
 
+// Returns a ready future. Continuations without an executor are called
+// right away, so a chain of them doesn't allocate anything.
+template <typename T>
+Future<std::decay_t<T>> makeReadyFuture(T&& value);
+
+Future<> makeReadyFuture();
+
 }
 
 #include "details/FutureImpl.hpp"
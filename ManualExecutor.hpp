@@ -23,6 +23,18 @@ public:
     m_queue.push_back(std::move(func));
   }
 
+  inline void addBatch(std::vector<Func> funcs) override
+  {
+    std::lock_guard<std::mutex> g(m_queueMutex);
+    if (m_queue.empty()) {
+      std::swap(m_queue, funcs);
+    } else {
+      m_queue.insert(m_queue.end(),
+                     std::make_move_iterator(funcs.begin()),
+                     std::make_move_iterator(funcs.end()));
+    }
+  }
+
   inline size_t run()
   {
     std::vector<Func> todo;
@@ -30,6 +42,7 @@ public:
       std::unique_lock<std::mutex> lock(m_queueMutex);
       std::swap(todo, m_queue);
     }
+    CurrentScope scope(this);
     for (Func& f : todo)
       f();
     return todo.size();
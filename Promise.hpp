@@ -2,22 +2,47 @@
 
 #include "Future.hpp"
 
+#include <stdexcept>
+
 namespace Pledge {
 
+// Error set to the future if its promise is destroyed without setting a
+// value or an error.
+class BrokenPromise : public std::logic_error
+{
+public:
+  using std::logic_error::logic_error;
+};
+
+// In builds with PLEDGE_DEBUG_REGISTRY the constructors take an extra
+// defaulted argument that records where the promise was created, for
+// liveFutures(). Normal builds don't have it.
 template <typename T = void>
 class Promise
 {
 public:
+#ifdef PLEDGE_DEBUG_REGISTRY
+  Promise(Impl::Site site = Impl::Site::current());
+#else
   Promise();
+#endif
+
+  // Sets BrokenPromise error to the future if the promise wasn't fulfilled
+  ~Promise();
 
   Promise(const Promise&) = delete;
   Promise& operator=(const Promise&) = delete;
 
   Promise(Promise&&) = default;
-  Promise& operator=(Promise&&) = default;
+  Promise& operator=(Promise&&);
 
+#ifdef PLEDGE_DEBUG_REGISTRY
+  template <typename Y>
+  Promise(Y&& t, Impl::Site site = Impl::Site::current());
+#else
   template <typename Y>
   Promise(Y&& t);
+#endif
 
   Future<T> future(Executor* executor = nullptr);
 
@@ -34,15 +59,30 @@ public:
 
 private:
   std::shared_ptr<FutureDataType<T>> m_data;
+  bool m_fulfilled = false;
 };
 
 template <>
 class Promise<void>
 {
 public:
+#ifdef PLEDGE_DEBUG_REGISTRY
+  Promise(Impl::Site site = Impl::Site::current());
+
+  Promise(void_type t, Impl::Site site = Impl::Site::current());
+#else
   Promise();
 
   Promise(void_type t);
+#endif
+
+  ~Promise();
+
+  Promise(const Promise&) = delete;
+  Promise& operator=(const Promise&) = delete;
+
+  Promise(Promise&&) = default;
+  Promise& operator=(Promise&&);
 
   Future<> future(Executor* executor = nullptr);
 
@@ -55,11 +95,12 @@ public:
 
 private:
   std::shared_ptr<FutureData<void_type>> m_data;
+  bool m_fulfilled = false;
 };
 
 // Create a new future from the result of 'f' executed in the given executor.
 template <typename F>
-auto via(Executor* executor, F&& f) -> FutureType<typename Type<F>::Ret>;
+auto via(Executor* executor, F&& f) -> FutureType<ThenRet<F, void>>;
 
 }
 
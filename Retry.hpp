@@ -0,0 +1,53 @@
+#pragma once
+
+#include "Timer.hpp"
+
+namespace Pledge {
+
+// Exponential backoff configuration for retry().
+struct RetryPolicy
+{
+  // Total number of attempts, including the first one.
+  size_t maxAttempts = 3;
+  // Delay before the second attempt. Each following delay is multiplied
+  // by 'multiplier', up to 'maxDelay'.
+  Timer::Clock::duration initialDelay = std::chrono::milliseconds(10);
+  Timer::Clock::duration maxDelay = std::chrono::seconds(1);
+  double multiplier = 2.0;
+  // A random fraction of the delay up to this is subtracted from each delay,
+  // so that failing clients don't all retry at the same time.
+  double jitter = 0.5;
+};
+
+// Calls 'factory' and returns a future with its result. If the result is an
+// error, 'factory' is called again after a delay given by 'policy', until it
+// succeeds or there are no more attempts left, in which case the future has
+// the last error.
+//
+// 'factory' can return either a value or a future. The first attempt is
+// made in the calling thread and the retries in the timer thread, so
+// 'factory' should just start the asynchronous operation.
+//
+// If 'timer' is destroyed while waiting for the next attempt, the future
+// gets the last error right away. The timer must not be destroyed while an
+// attempt is running.
+template <typename F>
+auto retry(Timer* timer, RetryPolicy policy, F&& factory) -> FutureType<ThenRet<F, void>>;
+
+// Calls 'factory' and returns a future with its result. If the result isn't
+// ready within 'delay', 'factory' is called a second time and whichever
+// attempt succeeds first sets the result. The second attempt is also made
+// immediately if the first one fails before 'delay'. The future has an
+// error only if both attempts fail.
+//
+// 'delay' is typically a high percentile of the expected latency, which
+// cuts the tail latency with a small amount of extra requests. The timer
+// task is cancelled as soon as it's not needed, and if 'timer' is destroyed
+// before 'delay', the second attempt is just not made.
+template <typename F>
+auto hedge(Timer* timer, Timer::Clock::duration delay, F&& factory)
+  -> FutureType<ThenRet<F, void>>;
+
+}
+
+#include "details/RetryImpl.hpp"
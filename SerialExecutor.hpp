@@ -0,0 +1,182 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "Executor.hpp"
+
+namespace Pledge {
+
+// Runs tasks one at a time in the order they were added, using another
+// executor for the actual work. Also known as a strand: thousands of these
+// can share one ThreadPoolExecutor, and tasks of the same SerialExecutor
+// never overlap, so they can access the same state without a mutex.
+//
+// No thread is dedicated to the executor. The first added task schedules
+// a single drain task to the parent executor, which then runs up to
+// 'batchSize' queued tasks before giving the parent thread to others.
+//
+// Destroying the executor waits until all added tasks have been run, so it
+// must not be destroyed from one of its own tasks.
+class SerialExecutor : public Executor
+{
+public:
+  inline SerialExecutor(Executor* parent, size_t batchSize = 64)
+    : m_parent(parent)
+    , m_batchSize(batchSize > 0 ? batchSize : 1)
+  {}
+
+  inline ~SerialExecutor()
+  {
+    // The drain task doesn't touch the executor after the count drops to zero
+    while (m_pending.load(std::memory_order_acquire) != 0)
+      std::this_thread::yield();
+
+    Node* node = m_tail;
+    while (node) {
+      Node* next = node->next.load(std::memory_order_relaxed);
+      if (node != &m_stub)
+        delete node;
+      node = next;
+    }
+  }
+
+  SerialExecutor(const SerialExecutor&) = delete;
+  SerialExecutor& operator=(const SerialExecutor&) = delete;
+
+  inline void add(Func func) override
+  {
+    push(new Node(std::move(func)));
+    // Only the transition from zero schedules a drain, the running drain
+    // picks up everything added after that.
+    if (m_pending.fetch_add(1, std::memory_order_acq_rel) == 0)
+      schedule();
+  }
+
+  // Links the whole batch before counting it, so at most one drain task is
+  // scheduled for it.
+  inline void addBatch(std::vector<Func> funcs) override
+  {
+    if (funcs.empty())
+      return;
+    for (Func& func : funcs)
+      push(new Node(std::move(func)));
+    if (m_pending.fetch_add(funcs.size(), std::memory_order_acq_rel) == 0)
+      schedule();
+  }
+
+  // Continuations triggered by a task of this executor can run right away,
+  // they are still serialized with the other tasks.
+  inline bool canRunInline() const override { return current() == this; }
+
+  inline BlockingPolicy blockingPolicy() const override { return m_parent->blockingPolicy(); }
+
+  // Helping runs tasks of the parent, which is where the value a task of
+  // this executor waits for is usually produced. Our own queue can't be
+  // helped with, since the waiting task is the one draining it.
+  inline bool tryRunOne() override { return m_parent->tryRunOne(); }
+
+  inline void helpUntil(const std::function<bool()>& ready) override
+  {
+    m_parent->helpUntil(ready);
+  }
+
+  inline void wakeHelpers() override { m_parent->wakeHelpers(); }
+
+  inline Executor* parent() const { return m_parent; }
+
+private:
+  struct Node
+  {
+    inline Node() {}
+
+    inline Node(Func func)
+      : func(std::move(func))
+    {}
+
+    std::atomic<Node*> next{ nullptr };
+    Func func;
+  };
+
+  inline void schedule()
+  {
+    m_parent->add([this] { drain(); });
+  }
+
+  inline void drain()
+  {
+    size_t count = std::min(m_pending.load(std::memory_order_acquire), m_batchSize);
+    {
+      CurrentScope scope(this);
+      for (size_t i = 0; i < count; ++i) {
+        Node* node = pop();
+        node->func();
+        delete node;
+      }
+    }
+    // Someone added more tasks while we were running, keep going later
+    if (m_pending.fetch_sub(count, std::memory_order_acq_rel) != count)
+      schedule();
+  }
+
+  // Intrusive multi-producer single-consumer queue by Dmitry Vyukov. Adding
+  // is a single exchange, and only the drain task pops.
+  inline void push(Node* node)
+  {
+    node->next.store(nullptr, std::memory_order_relaxed);
+    Node* prev = m_head.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+  }
+
+  // Returns a node that is counted in m_pending. The node is always in the
+  // queue, but an earlier push might still be linking its predecessor, in
+  // which case this waits for it.
+  inline Node* pop()
+  {
+    for (;;) {
+      if (Node* node = tryPop())
+        return node;
+      std::this_thread::yield();
+    }
+  }
+
+  inline Node* tryPop()
+  {
+    Node* tail = m_tail;
+    Node* next = tail->next.load(std::memory_order_acquire);
+    if (tail == &m_stub) {
+      if (!next)
+        return nullptr;
+      m_tail = next;
+      tail = next;
+      next = next->next.load(std::memory_order_acquire);
+    }
+    if (next) {
+      m_tail = next;
+      return tail;
+    }
+    if (tail != m_head.load(std::memory_order_acquire))
+      return nullptr;
+    // 'tail' is the last node, put the stub after it so it can be removed
+    push(&m_stub);
+    next = tail->next.load(std::memory_order_acquire);
+    if (next) {
+      m_tail = next;
+      return tail;
+    }
+    return nullptr;
+  }
+
+  Executor* m_parent;
+  size_t m_batchSize;
+  // Number of added tasks that haven't finished yet
+  std::atomic<size_t> m_pending{ 0 };
+  Node m_stub;
+  std::atomic<Node*> m_head{ &m_stub };
+  // Only accessed by the drain task
+  Node* m_tail = &m_stub;
+};
+
+}
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <vector>
+
+#include "Promise.hpp"
+
+namespace Pledge {
+
+class Simulation;
+
+// Logical executor driven by a Simulation. Like ManualExecutor, tasks are
+// just queued when they are added, and they are run in FIFO order when the
+// simulation is stepped.
+class SimulatedExecutor : public Executor
+{
+public:
+  inline void add(Func func) override;
+
+  // Virtual time each task spent queued before it was started, in the order
+  // the tasks were run.
+  inline std::vector<std::chrono::nanoseconds> latencies() const;
+
+private:
+  friend class Simulation;
+
+  struct Task
+  {
+    Func func;
+    std::chrono::nanoseconds queued;
+  };
+
+  inline SimulatedExecutor(Simulation& simulation)
+    : m_simulation(simulation)
+  {}
+
+  inline void run(Func& func)
+  {
+    CurrentScope scope(this);
+    func();
+  }
+
+  Simulation& m_simulation;
+  std::deque<Task> m_queue;
+  std::vector<std::chrono::nanoseconds> m_latencies;
+};
+
+// Deterministic single-threaded scheduler for testing future chains. Any
+// number of logical executors can be created, and each step runs the next
+// task of a randomly selected executor, so different seeds explore different
+// interleavings of the same chains while the same seed always reproduces the
+// same schedule.
+//
+// Time is virtual: it advances by 'taskCost' for each task, by calls to
+// advance() from the tasks, and jumps directly to the next timer when there
+// is nothing else to do. All logical executors share the same clock, as if
+// they were running on a single CPU.
+class Simulation
+{
+public:
+  using Duration = std::chrono::nanoseconds;
+
+  inline Simulation(uint64_t seed, Duration taskCost = Duration(0))
+    : m_random(seed)
+    , m_taskCost(taskCost)
+  {}
+
+  Simulation(const Simulation&) = delete;
+  Simulation& operator=(const Simulation&) = delete;
+
+  // Creates a new logical executor. The executor is owned by the simulation.
+  inline SimulatedExecutor* createExecutor()
+  {
+    std::lock_guard<std::mutex> g(m_mutex);
+    m_executors.emplace_back(new SimulatedExecutor(*this));
+    return m_executors.back().get();
+  }
+
+  // Runs a single task, or advances the clock to the next timer and fires
+  // it if no executor has queued tasks. Returns false if there was nothing
+  // to do.
+  inline bool step()
+  {
+    Executor::Func func;
+    SimulatedExecutor* executor = nullptr;
+    {
+      std::lock_guard<std::mutex> g(m_mutex);
+      std::vector<SimulatedExecutor*> ready;
+      for (auto& e : m_executors)
+        if (!e->m_queue.empty())
+          ready.push_back(e.get());
+
+      if (!ready.empty()) {
+        // The distributions of the standard library differ between
+        // implementations, the engine output itself is specified exactly
+        executor = ready[size_t(m_random() % ready.size())];
+        SimulatedExecutor::Task& task = executor->m_queue.front();
+        executor->m_latencies.push_back(m_now - task.queued);
+        func = std::move(task.func);
+        executor->m_queue.pop_front();
+        m_now += m_taskCost;
+      } else if (!m_timers.empty()) {
+        std::pop_heap(m_timers.begin(), m_timers.end(), Later());
+        m_now = std::max(m_now, m_timers.back().time);
+        func = std::move(m_timers.back().func);
+        m_timers.pop_back();
+      } else {
+        return false;
+      }
+    }
+
+    if (executor)
+      executor->run(func);
+    else
+      func();
+    return true;
+  }
+
+  // Steps until there is nothing to do, or 'maxSteps' have been taken.
+  // Returns the number of steps taken.
+  inline size_t run(size_t maxSteps = SIZE_MAX)
+  {
+    size_t steps = 0;
+    while (steps < maxSteps && step())
+      ++steps;
+    return steps;
+  }
+
+  // Current virtual time since the simulation was created
+  inline Duration now() const
+  {
+    std::lock_guard<std::mutex> g(m_mutex);
+    return m_now;
+  }
+
+  // Moves the clock forward. Tasks can call this to simulate doing work.
+  inline void advance(Duration duration)
+  {
+    std::lock_guard<std::mutex> g(m_mutex);
+    m_now += duration;
+  }
+
+  // Returns a future that becomes ready when the virtual clock has advanced
+  // by 'delay'.
+  inline Future<> after(Duration delay, Executor* executor = nullptr)
+  {
+    auto promise = std::make_shared<Promise<>>();
+    Future<> future = promise->future(executor);
+    std::lock_guard<std::mutex> g(m_mutex);
+    m_timers.push_back({ m_now + delay, m_timerSeq++, [promise] { promise->setValue(); } });
+    std::push_heap(m_timers.begin(), m_timers.end(), Later());
+    return future;
+  }
+
+private:
+  friend class SimulatedExecutor;
+
+  struct Timer
+  {
+    Duration time;
+    uint64_t seq;
+    Executor::Func func;
+  };
+
+  // Makes std::push_heap build a min-heap
+  struct Later
+  {
+    inline bool operator()(const Timer& a, const Timer& b) const
+    {
+      return a.time == b.time ? a.seq > b.seq : a.time > b.time;
+    }
+  };
+
+  // Tasks can be added from other threads, although then the simulation
+  // isn't deterministic anymore.
+  mutable std::mutex m_mutex;
+  std::mt19937_64 m_random;
+  Duration m_taskCost;
+  Duration m_now{ 0 };
+  uint64_t m_timerSeq = 0;
+  std::vector<std::unique_ptr<SimulatedExecutor>> m_executors;
+  std::vector<Timer> m_timers;
+};
+
+void SimulatedExecutor::add(Func func)
+{
+  std::lock_guard<std::mutex> g(m_simulation.m_mutex);
+  m_queue.push_back({ std::move(func), m_simulation.m_now });
+}
+
+std::vector<std::chrono::nanoseconds> SimulatedExecutor::latencies() const
+{
+  std::lock_guard<std::mutex> g(m_simulation.m_mutex);
+  return m_latencies;
+}
+
+}
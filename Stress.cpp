@@ -0,0 +1,237 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "Promise.hpp"
+#include "SerialExecutor.hpp"
+#include "TaskGroup.hpp"
+#include "ThreadPoolExecutor.hpp"
+#include "Window.hpp"
+
+// Hammers the racy parts of the library from many threads for a while:
+// continuations added while the value is being set, random chains hopping
+// between executors, task groups and pool shutdown with tasks still being
+// added. Build it with the tsan or asan preset to catch races and memory
+// errors, the program itself only checks the computed values.
+//
+// The scenarios run one after another, each with all threads for an equal
+// share of the time, so that the throughput of one isn't limited by the
+// others.
+//
+// Usage: stress [seconds] [threads] [seed]
+
+using namespace Pledge;
+using Clock = std::chrono::steady_clock;
+
+std::atomic<size_t> s_failures{ 0 };
+
+#define STRESS_CHECK(test)                                                                         \
+  do {                                                                                             \
+    if (!(test)) {                                                                                 \
+      s_failures.fetch_add(1, std::memory_order_relaxed);                                          \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #test);                     \
+    }                                                                                              \
+  } while (false)
+
+ThreadPoolExecutor s_poolA{ 4 };
+ThreadPoolExecutor s_poolB{ 4, 4 };
+
+Executor* randomExecutor(std::mt19937& random)
+{
+  switch (random() % 3) {
+    case 0:
+      return &s_poolA;
+    case 1:
+      return &s_poolB;
+    default:
+      return nullptr;
+  }
+}
+
+Executor* randomPool(std::mt19937& random)
+{
+  return random() % 2 ? &s_poolA : &s_poolB;
+}
+
+// setValue in a worker races with then() in this thread
+void raceThenSetValue(std::mt19937& random)
+{
+  auto promise = std::make_shared<Promise<int>>();
+  int value = int(random() % 1000);
+  auto future = promise->future(randomExecutor(random));
+  randomPool(random)->add([promise, value] { promise->setValue(value); });
+  STRESS_CHECK(std::move(future).then([](int v) { return v + 1; }).get() == value + 1);
+}
+
+// The promise is destroyed in a worker while continuations are added. The
+// continuations don't keep the promise state alive, so the promise often
+// holds the last reference when it's destroyed.
+void raceBrokenPromise(std::mt19937& random)
+{
+  auto promise = std::make_shared<Promise<int>>();
+  auto future = promise->future().then([](int v) { return v; });
+  randomPool(random)->add([promise = std::move(promise)]() mutable { promise.reset(); });
+  int ret = std::move(future).error([](const BrokenPromise&) { return -1; }).get();
+  STRESS_CHECK(ret == -1);
+}
+
+// Random chain where every step adds one to the value
+void randomChain(std::mt19937& random)
+{
+  size_t length = 1 + random() % 8;
+  Future<int> future = via(randomExecutor(random), [] { return 0; });
+  for (size_t i = 0; i < length; ++i) {
+    Executor* executor = randomExecutor(random);
+    switch (random() % 6) {
+      case 0:
+        future = std::move(future).then([](int v) { return v + 1; });
+        break;
+      case 1:
+        future = std::move(future).thenInline([](const int& v) { return v + 1; });
+        break;
+      case 2:
+        future = std::move(future).thenOn(executor, [](int v) { return v + 1; });
+        break;
+      case 3:
+        future = std::move(future).via(executor).then([](int v) { return v + 1; });
+        break;
+      case 4:
+        future = std::move(future).then([executor](int v) {
+          return via(executor, [v] { return v + 1; });
+        });
+        break;
+      default:
+        future = std::move(future)
+                   .then([](int v) -> int { throw v; })
+                   .error([](int v) { return v + 1; });
+        break;
+    }
+  }
+  STRESS_CHECK(std::move(future).get() == int(length));
+}
+
+// Spawns tasks to a group and waits for them
+void taskGroup(std::mt19937& random)
+{
+  std::atomic<int> sum{ 0 };
+  {
+    TaskGroup group(randomExecutor(random));
+    for (int i = 0; i < 16; ++i)
+      group.spawn([&sum] { sum.fetch_add(1, std::memory_order_relaxed); });
+  }
+  STRESS_CHECK(sum.load() == 16);
+}
+
+// Destroys a pool while its tasks are still adding more tasks
+void poolShutdown(std::mt19937& random)
+{
+  std::atomic<int> ran{ 0 };
+  {
+    ThreadPoolExecutor pool(2, 1 + random() % 2);
+    for (int i = 0; i < 8; ++i) {
+      pool.add([&pool, &ran] {
+        ran.fetch_add(1, std::memory_order_relaxed);
+        pool.add([&ran] { ran.fetch_add(1, std::memory_order_relaxed); });
+      });
+    }
+  }
+  STRESS_CHECK(ran.load() == 16);
+}
+
+// Tasks added to a serial executor from this thread and from a worker
+// increment a plain int without locking
+void serialExecutor(std::mt19937& random)
+{
+  SerialExecutor serial(randomPool(random), 1 + random() % 8);
+  int counter = 0;
+  auto promise = std::make_shared<Promise<>>();
+  auto added = promise->future();
+  randomPool(random)->add([&serial, &counter, promise] {
+    for (int i = 0; i < 32; ++i)
+      serial.add([&counter] { ++counter; });
+    promise->setValue();
+  });
+  for (int i = 0; i < 32; ++i)
+    serial.add([&counter] { ++counter; });
+  std::move(added).get();
+  STRESS_CHECK(via(&serial, [&counter] { return counter; }).get() == 64);
+}
+
+// Windowed map where the items return futures from another executor
+void windowMap(std::mt19937& random)
+{
+  std::vector<int> input(64, 1);
+  Executor* other = randomExecutor(random);
+  auto results = window(randomExecutor(random), input, 1 + random() % 8, [other](int v) {
+                   return via(other, [v] { return v + 1; });
+                 }).get();
+  STRESS_CHECK(results.size() == input.size());
+}
+
+struct Scenario
+{
+  const char* name;
+  void (*func)(std::mt19937&);
+};
+
+// Runs 'scenario' from 'threadCount' threads for 'seconds' and returns the
+// number of completed runs
+size_t run(const Scenario& scenario, double seconds, size_t threadCount, unsigned seed)
+{
+  std::atomic<size_t> ops{ 0 };
+  auto deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                                   std::chrono::duration<double>(seconds));
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < threadCount; ++i) {
+    threads.emplace_back([&, i] {
+      std::mt19937 random(seed + unsigned(i));
+      size_t done = 0;
+      while (Clock::now() < deadline) {
+        scenario.func(random);
+        ++done;
+      }
+      ops.fetch_add(done, std::memory_order_relaxed);
+    });
+  }
+  for (std::thread& t : threads)
+    t.join();
+  return ops.load();
+}
+
+int main(int argc, char* argv[])
+{
+  double seconds = argc > 1 ? std::strtod(argv[1], nullptr) : 5;
+  size_t threadCount = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 4;
+  unsigned seed = argc > 3 ? unsigned(std::strtoul(argv[3], nullptr, 10)) : std::random_device()();
+
+  const Scenario scenarios[] = {
+    { "then/setValue race", raceThenSetValue },
+    { "broken promise race", raceBrokenPromise },
+    { "random chain", randomChain },
+    { "task group", taskGroup },
+    { "pool shutdown", poolShutdown },
+    { "serial executor", serialExecutor },
+    { "window", windowMap },
+  };
+  size_t scenarioCount = sizeof(scenarios) / sizeof(scenarios[0]);
+  double slice = seconds / scenarioCount;
+
+  printf("Running %zu threads for %.1f s with seed %u\n", threadCount, seconds, seed);
+  printf("%-20s %10s %12s\n", "scenario", "ops", "ops/s");
+  for (const Scenario& scenario : scenarios) {
+    size_t ops = run(scenario, slice, threadCount, seed);
+    printf("%-20s %10zu %12.0f\n", scenario.name, ops, ops / slice);
+  }
+
+  size_t failures = s_failures.load();
+  if (failures) {
+    printf("%zu checks failed\n", failures);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "Promise.hpp"
+
+namespace Pledge {
+
+// TaskGroup owns a set of in-flight futures. Futures are added to the group
+// with spawn() or add(), and join() returns a future that becomes ready once
+// all of them have finished, either with a value or an error.
+//
+// Destroying the group blocks until all tracked futures have finished, so
+// continuations can safely capture objects that are destroyed after the
+// group. Don't destroy the group or wait for join() from a task that is
+// itself tracked by the same group, that would wait for itself.
+class TaskGroup
+{
+public:
+  inline TaskGroup(Executor* executor = nullptr)
+    : m_executor(executor)
+    , m_state(std::make_shared<State>())
+  {}
+
+  inline ~TaskGroup() { join().get(); }
+
+  TaskGroup(const TaskGroup&) = delete;
+  TaskGroup& operator=(const TaskGroup&) = delete;
+
+  // Calls 'f' in the group executor and tracks the returned future.
+  template <typename F>
+  auto spawn(F&& f) -> FutureType<ThenRet<F, void>>
+  {
+    return add(via(m_executor, std::forward<F>(f)));
+  }
+
+  // Tracks an existing future. The returned future has the same value or
+  // error as the original one.
+  //
+  // Only 'future' itself is tracked. Continuations added to the returned
+  // future run after the group has stopped waiting for it, so work that the
+  // group must wait for needs to be chained before add(), or be part of the
+  // function passed to spawn().
+  template <typename T>
+  Future<T> add(Future<T>&& future)
+  {
+    m_state->pending.fetch_add(1, std::memory_order_relaxed);
+    return Impl::onComplete(std::move(future), [state = m_state] { state->release(); });
+  }
+
+  // Returns a future that becomes ready once all futures added to the group
+  // so far have finished.
+  inline Future<> join()
+  {
+    std::lock_guard<std::mutex> g(m_state->mutex);
+    if (m_state->pending.load(std::memory_order_acquire) == 0)
+      return Promise<>(void_type{}).future();
+    m_state->joiners.emplace_back();
+    return m_state->joiners.back().future();
+  }
+
+  // Number of futures in the group that haven't finished yet.
+  inline size_t pending() const { return m_state->pending.load(std::memory_order_acquire); }
+
+private:
+  // Shared with the tracking continuations, so that a future finishing
+  // concurrently with the group destruction doesn't touch freed memory.
+  struct State
+  {
+    inline void release()
+    {
+      if (pending.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
+
+      std::vector<Promise<>> done;
+      {
+        std::lock_guard<std::mutex> g(mutex);
+        // Someone might have added a new future in between
+        if (pending.load(std::memory_order_acquire) != 0)
+          return;
+        std::swap(done, joiners);
+      }
+      for (Promise<>& promise : done)
+        promise.setValue();
+    }
+
+    std::atomic<size_t> pending{ 0 };
+    std::mutex mutex;
+    std::vector<Promise<>> joiners;
+  };
+
+  Executor* m_executor;
+  std::shared_ptr<State> m_state;
+};
+
+}
@@ -1,14 +1,110 @@
+#include <array>
 #include <atomic>
 #include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <numeric>
+#include <set>
 #include <sstream>
 #include <thread>
 
 #include "ManualExecutor.hpp"
 #include "Promise.hpp"
+#include "Retry.hpp"
+#include "SerialExecutor.hpp"
+#include "Simulation.hpp"
+#include "TaskGroup.hpp"
 #include "ThreadPoolExecutor.hpp"
+#include "Window.hpp"
 
 Pledge::ThreadPoolExecutor pool{ 8 };
 
+// Heap allocations made by the current thread
+thread_local size_t t_allocations = 0;
+
+// All replaced allocation functions go through these two. They are kept out
+// of line, so that the compiler doesn't pair an inlined free() with a call
+// to operator new and warn about a mismatch.
+[[gnu::noinline]] void* countedAlloc(size_t size, size_t align)
+{
+  ++t_allocations;
+  size = size ? size : 1;
+  void* ptr = nullptr;
+  if (align <= alignof(std::max_align_t))
+    ptr = std::malloc(size);
+  else
+    ptr = std::aligned_alloc(align, (size + align - 1) / align * align);
+  if (!ptr)
+    throw std::bad_alloc();
+  return ptr;
+}
+
+[[gnu::noinline]] void countedFree(void* ptr) noexcept
+{
+  std::free(ptr);
+}
+
+void* operator new(size_t size)
+{
+  return countedAlloc(size, 0);
+}
+
+void* operator new[](size_t size)
+{
+  return countedAlloc(size, 0);
+}
+
+void* operator new(size_t size, std::align_val_t align)
+{
+  return countedAlloc(size, size_t(align));
+}
+
+void* operator new[](size_t size, std::align_val_t align)
+{
+  return countedAlloc(size, size_t(align));
+}
+
+void operator delete(void* ptr) noexcept
+{
+  countedFree(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+  countedFree(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+  countedFree(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept
+{
+  countedFree(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept
+{
+  countedFree(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept
+{
+  countedFree(ptr);
+}
+
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept
+{
+  countedFree(ptr);
+}
+
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept
+{
+  countedFree(ptr);
+}
+
 std::string s_prev;
 
 template <typename T>
@@ -68,6 +164,41 @@ void checkPrev(const E& expected, const char* expectedStr, const char* file, int
           s_prev.c_str());
 }
 
+struct MoveCounter
+{
+  MoveCounter(int* moves)
+    : moves(moves)
+  {}
+  MoveCounter(MoveCounter&& o)
+    : moves(o.moves)
+  {
+    ++*moves;
+  }
+  MoveCounter(const MoveCounter&) = delete;
+
+  int* moves;
+};
+
+struct CopyCounter
+{
+  CopyCounter(int* copies)
+    : copies(copies)
+  {}
+  CopyCounter(const CopyCounter& o)
+    : copies(o.copies)
+  {
+    ++*copies;
+  }
+  CopyCounter(CopyCounter&&) = default;
+
+  int* copies;
+};
+
+int twice(int v)
+{
+  return v * 2;
+}
+
 #define CHECK(test) check((test), #test, __FILE__, __LINE__)
 #define CHECK_EQUAL(expected, actual)                                                              \
   checkEqual((expected), (actual), #expected, #actual, __FILE__, __LINE__)
@@ -251,5 +382,768 @@ int main()
     via(&pool, [] {}).get();
   }
 
+  {
+    std::atomic<int> count{ 0 };
+    std::vector<Executor::Func> funcs;
+    for (int i = 0; i < 100; ++i)
+      funcs.push_back([&count] { ++count; });
+    pool.addBatch(std::move(funcs));
+    while (count != 100)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    CHECK_EQUAL(100, count);
+  }
+
+  {
+    std::atomic<int> count{ 0 };
+    {
+      ThreadPoolExecutor sharded{ 4, 4 };
+      std::vector<std::thread> producers;
+      for (int i = 0; i < 8; ++i) {
+        producers.emplace_back([&sharded, &count] {
+          for (int j = 0; j < 1000; ++j)
+            sharded.add([&count] { ++count; });
+        });
+      }
+      for (std::thread& t : producers)
+        t.join();
+    }
+    // The destructor runs the remaining tasks
+    CHECK_EQUAL(8000, count);
+  }
+
+  {
+    ManualExecutor manual;
+    int count = 0;
+    manual.add([&count] { ++count; });
+    manual.addBatch({ [&count] { count += 10; }, [&count] { count += 100; } });
+    CHECK_EQUAL(3, manual.run());
+    CHECK_EQUAL(111, count);
+  }
+
+  {
+    std::atomic<int> count{ 0 };
+    TaskGroup group(&pool);
+    for (int i = 0; i < 20; ++i) {
+      group.spawn([&count] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        ++count;
+      });
+    }
+    group.join().get();
+    CHECK_EQUAL(20, count);
+    CHECK_EQUAL(0, group.pending());
+  }
+
+  {
+    std::atomic<bool> done{ false };
+    Promise<int> promise;
+    {
+      TaskGroup group(&pool);
+      group.spawn([&done] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        done = true;
+      });
+      auto future = group.add(promise.future()).then([](int v) { return v + 1; });
+      CHECK(group.pending() > 0);
+      promise.setError(std::runtime_error("group"));
+      CHECK(future.hasError());
+    }
+    CHECK(done.load());
+  }
+
+  {
+    // The tracking link runs in the completing thread, and the returned
+    // future keeps the value and the executor
+    ManualExecutor manual;
+    TaskGroup group;
+    Promise<int> promise;
+    auto future = group.add(promise.future(&manual)).then([](int v) { return v + 1; });
+    auto ready = group.add(makeReadyFuture(2));
+    CHECK_EQUAL(1, group.pending());
+    promise.setValue(1);
+    CHECK_EQUAL(0, group.pending());
+    CHECK(!future.isReady());
+    CHECK_EQUAL(1, manual.run());
+    CHECK_EQUAL(2, std::move(future).get());
+    CHECK_EQUAL(2, std::move(ready).get());
+  }
+
+  {
+    // The value is handed directly to the waiting continuation
+    int moves = 0;
+    Promise<MoveCounter> promise;
+    promise.future().then([](MoveCounter) {});
+    promise.setValue(MoveCounter(&moves));
+    CHECK_EQUAL(1, moves);
+  }
+
+  {
+    // Reference continuations use the value in place
+    int moves = 0;
+    Promise<MoveCounter> promise;
+    auto future = promise.future()
+                    .then([](MoveCounter& v) { return v.moves; })
+                    .then([&moves](int* m) { return m == &moves; });
+    promise.setValue(MoveCounter(&moves));
+    CHECK_EQUAL(0, moves);
+    CHECK(std::move(future).get());
+
+    Promise<MoveCounter> stored{ MoveCounter(&moves) };
+    moves = 0;
+    stored.future().then([](const MoveCounter&) {});
+    CHECK_EQUAL(0, moves);
+  }
+
+  {
+    // A continuation capturing two pointers fits in the callback, so then()
+    // allocates only the next shared state, same as without captures
+    Promise<int> promise;
+    auto future = promise.future();
+    size_t before = t_allocations;
+    auto empty = std::move(future).then([](int v) { return v; });
+    size_t emptyAllocations = t_allocations - before;
+
+    int a = 1, b = 2;
+    before = t_allocations;
+    auto captured = std::move(empty).then([&a, &b](int v) { return v + a + b; });
+    CHECK_EQUAL(emptyAllocations, t_allocations - before);
+    promise.setValue(3);
+    CHECK_EQUAL(6, std::move(captured).get());
+  }
+
+  {
+    // Returned futures are spliced to the chain without extra moves
+    int moves = 0;
+    Promise<MoveCounter> inner;
+    Promise<> outer;
+    auto future = outer.future()
+                    .then([&inner] { return inner.future(); })
+                    .then([](MoveCounter& v) { return *v.moves; });
+    outer.setValue();
+    inner.setValue(MoveCounter(&moves));
+    CHECK_EQUAL(0, std::move(future).get());
+  }
+
+  {
+    // The second continuation runs in the same worker without a queue hop
+    Promise<> promise;
+    auto future = promise.future(&pool)
+                    .then([] { return std::this_thread::get_id(); })
+                    .then([](std::thread::id id) { return id == std::this_thread::get_id(); });
+    promise.setValue();
+    CHECK(std::move(future).get());
+  }
+
+  {
+    // A continuation added in a worker to a future that is already ready is
+    // queued, so another worker runs it while this one is still busy
+    std::atomic<bool> ran{ false };
+    auto future = via(&pool, [&ran] {
+      Promise<> promise;
+      promise.setValue();
+      auto id = std::this_thread::get_id();
+      auto inner = promise.future(&pool).then([&ran, id] {
+        ran = true;
+        return id != std::this_thread::get_id();
+      });
+      while (!ran)
+        std::this_thread::yield();
+      return inner;
+    });
+    CHECK(std::move(future).get());
+  }
+
+  {
+    // Nested via() fans out to another worker too
+    std::atomic<bool> ran{ false };
+    auto future = via(&pool, [&ran] {
+      auto id = std::this_thread::get_id();
+      auto inner = via(&pool, [&ran, id] {
+        ran = true;
+        return id != std::this_thread::get_id();
+      });
+      while (!ran)
+        std::this_thread::yield();
+      return inner;
+    });
+    CHECK(std::move(future).get());
+  }
+
+  {
+    // thenInline runs in the thread that sets the value, even with an executor
+    Promise<int> promise;
+    auto future = promise.future(&pool).thenInline([](int v) {
+      return std::make_pair(v, std::this_thread::get_id());
+    });
+    promise.setValue(1);
+    CHECK(future.isReady());
+    CHECK(std::move(future).get().second == std::this_thread::get_id());
+  }
+
+  {
+    // Continuations are moved, not copied, when they are queued
+    ManualExecutor manual;
+    int copies = 0;
+    Promise<int> promise;
+    auto future = promise.future(&manual).then([c = CopyCounter(&copies)](int v) { return v; });
+    promise.setValue(1);
+    CHECK_EQUAL(1, manual.run());
+    CHECK_EQUAL(1, std::move(future).get());
+    CHECK_EQUAL(0, copies);
+  }
+
+  {
+    // thenOn overrides the executor just for one step
+    ManualExecutor manual;
+    Promise<int> promise;
+    auto future = promise.future(&pool)
+                    .thenOn(&manual, [](int v) { return v + 1; })
+                    .then([](int v) { return v + 1; })
+                    .thenInline([](int v) { return v * 2; });
+    promise.setValue(1);
+    CHECK(!future.isReady());
+    CHECK_EQUAL(1, manual.run());
+    CHECK_EQUAL(6, std::move(future).get());
+  }
+
+  {
+    // Waiting in the only worker thread for a task queued after it
+    ThreadPoolExecutor single{ 1 };
+    auto nested = [&single] {
+      return [&single] {
+        auto promise = std::make_shared<Promise<int>>();
+        auto future = promise->future();
+        single.add([promise] { promise->setValue(1); });
+        return std::move(future).get() + 1;
+      };
+    };
+
+    single.setBlockingPolicy(Executor::BlockingPolicy::Help);
+    CHECK_EQUAL(2, via(&single, nested()).get());
+
+    // A helping thread that has gone to sleep wakes up both for new tasks
+    // and when the value is set from outside the pool
+    for (bool fromPool : { true, false }) {
+      Promise<int> promise;
+      std::atomic<bool> waiting{ false };
+      auto future = via(&single, [&promise, &waiting] {
+        auto inner = promise.future();
+        waiting = true;
+        return std::move(inner).get();
+      });
+      while (!waiting)
+        std::this_thread::yield();
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      if (fromPool)
+        single.add([&promise] { promise.setValue(3); });
+      else
+        promise.setValue(3);
+      CHECK_EQUAL(3, std::move(future).get());
+    }
+
+    single.setBlockingPolicy(Executor::BlockingPolicy::Fail);
+    try {
+      via(&single, nested()).get();
+      CHECK(false);
+    } catch (const BlockingError&) {
+      CHECK(true);
+    }
+  }
+
+  {
+    // Too large to be stored inline in FutureData
+    std::array<int, 32> big{};
+    big[31] = 5;
+    Promise<int> promise;
+    auto future = promise.future(&pool).then([big](int v) { return v + big[31]; });
+    promise.setValue(1);
+    CHECK_EQUAL(6, std::move(future).get());
+  }
+
+  {
+    // Warm up the pool, after that the same chains should reuse the memory
+    for (int i = 0; i < 10; ++i)
+      Promise<int>(i).future().then([](int v) { return v + 1; }).get();
+    PoolStats before = poolStats();
+    for (int i = 0; i < 1000; ++i)
+      Promise<int>(i).future().then([](int v) { return v + 1; }).get();
+    PoolStats after = poolStats();
+    CHECK_EQUAL(before.misses, after.misses);
+    CHECK(after.hits >= before.hits + 2000);
+    CHECK(after.residentBytes > 0);
+  }
+
+  {
+    // Chains on ready futures don't allocate shared state
+    PoolStats before = poolStats();
+    auto future = makeReadyFuture(20)
+                    .then([](int v) { return v + 1; })
+                    .then([](int v) { return makeReadyFuture(v * 2); })
+                    .error([](std::exception_ptr) { return 0; });
+    CHECK(future.isReady());
+    CHECK_EQUAL(42, std::move(future).get());
+    CHECK_EQUAL(7, via(nullptr, [] { return 7; }).get());
+    PoolStats after = poolStats();
+    CHECK_EQUAL(before.hits + before.misses, after.hits + after.misses);
+
+    // Errors are kept in the future as well, and skip then() continuations
+    before = poolStats();
+    auto failed = makeReadyFuture()
+                    .then([] { throw std::runtime_error("ready"); })
+                    .then([] { CHECK(false); });
+    CHECK(failed.hasError());
+    CHECK(!failed.hasValue());
+    std::move(failed).error([](const std::runtime_error& e) { CHECK_EQUAL("ready", e.what()); });
+    CHECK_PREV("ready");
+    auto recovered = makeReadyFuture(1)
+                       .then([](int) -> int { throw std::runtime_error("ready"); })
+                       .error([](const std::logic_error&) { return 2; })
+                       .error([](const std::runtime_error&) { return makeReadyFuture(3); });
+    CHECK_EQUAL(3, std::move(recovered).get());
+    after = poolStats();
+    CHECK_EQUAL(before.hits + before.misses, after.hits + after.misses);
+
+    // Queued continuations still work
+    CHECK_EQUAL(3, makeReadyFuture(2).via(&pool).then([](int v) { return v + 1; }).get());
+  }
+
+  {
+    // error() on a ready future keeps the executor for the following links
+    ManualExecutor manual;
+    auto value = makeReadyFuture(1).via(&manual).error([](std::exception_ptr) { return 0; });
+    auto next = std::move(value).then([](int v) { return v + 1; });
+    CHECK(!next.isReady());
+    CHECK_EQUAL(1, manual.run());
+    CHECK_EQUAL(2, std::move(next).get());
+
+    // and an error handler is queued to it like any other continuation
+    auto failed = makeReadyFuture(1)
+                    .thenInline([](int) -> int { throw std::runtime_error("ready"); })
+                    .via(&manual)
+                    .error([](const std::runtime_error&) { return 5; });
+    CHECK(!failed.isReady());
+    CHECK_EQUAL(1, manual.run());
+    CHECK_EQUAL(5, std::move(failed).get());
+  }
+
+  {
+    // Large ready values go to shared state, so they don't grow every future
+    using Big = std::array<char, 1024>;
+    static_assert(sizeof(Future<Big>) <= sizeof(Future<int>));
+    Big big{};
+    big[1023] = 3;
+    auto future = makeReadyFuture(big);
+    CHECK(future.hasValue());
+    CHECK_EQUAL(4, std::move(future).then([](const Big& v) { return v[1023] + 1; }).get());
+
+    // and they can be returned from continuations
+    Promise<> promise;
+    auto spliced = promise.future().then([&big] { return makeReadyFuture(big); });
+    promise.setValue();
+    CHECK_EQUAL(3, int(std::move(spliced).get()[1023]));
+  }
+
+  Timer timer;
+  {
+    RetryPolicy policy;
+    policy.initialDelay = std::chrono::milliseconds(1);
+    int attempts = 0;
+    auto future = retry(&timer, policy, [&attempts] {
+      return via(&pool, [&attempts] {
+        if (++attempts < 3)
+          throw std::runtime_error("retry");
+        return attempts;
+      });
+    });
+    CHECK_EQUAL(3, std::move(future).get());
+  }
+
+  {
+    RetryPolicy policy;
+    policy.maxAttempts = 2;
+    policy.initialDelay = std::chrono::milliseconds(1);
+    std::atomic<int> attempts{ 0 };
+    auto future = retry(&timer, policy, [&attempts] {
+      ++attempts;
+      throw std::runtime_error("nope");
+    });
+    try {
+      std::move(future).get();
+      CHECK(false);
+    } catch (const std::runtime_error& error) {
+      CHECK_EQUAL("nope", error.what());
+    }
+    CHECK_EQUAL(2, attempts.load());
+  }
+
+  {
+    // The first attempt never finishes, the hedged one does
+    std::vector<Promise<int>> promises;
+    auto future = hedge(&timer, std::chrono::milliseconds(1), [&promises] {
+      promises.emplace_back();
+      if (promises.size() == 2)
+        promises.back().setValue(2);
+      return promises.back().future();
+    });
+    CHECK_EQUAL(2, std::move(future).get());
+    CHECK_EQUAL(2, promises.size());
+  }
+
+  {
+    std::atomic<int> attempts{ 0 };
+    auto future = hedge(&timer, std::chrono::seconds(10), [&attempts] { return ++attempts; });
+    CHECK_EQUAL(1, std::move(future).get());
+    CHECK_EQUAL(1, attempts.load());
+  }
+
+  {
+    // The pending timer task is cancelled once the first attempt wins, so
+    // it doesn't keep the factory alive until the delay
+    auto token = std::make_shared<int>(0);
+    auto promise = std::make_unique<Promise<int>>();
+    auto future = hedge(&timer, std::chrono::seconds(10), [token, &promise] {
+      return promise->future();
+    });
+    CHECK_EQUAL(2, token.use_count());
+    promise->setValue(1);
+    promise.reset();
+    CHECK_EQUAL(1, std::move(future).get());
+    CHECK_EQUAL(1, token.use_count());
+  }
+
+  {
+    // Destroying the timer breaks the pending after() futures. A retry
+    // waiting for its next attempt fails with the last error, and a hedge
+    // just doesn't make the second attempt.
+    auto local = std::make_unique<Timer>();
+    auto after = local->after(std::chrono::seconds(10));
+    RetryPolicy policy;
+    policy.initialDelay = std::chrono::seconds(10);
+    policy.jitter = 0;
+    auto retried = retry(local.get(), policy, []() -> int { throw std::runtime_error("nope"); });
+    Promise<int> promise;
+    int attempts = 0;
+    auto hedged = hedge(local.get(), std::chrono::seconds(10), [&promise, &attempts] {
+      ++attempts;
+      return promise.future();
+    });
+    local.reset();
+    CHECK(after.hasError());
+    std::move(after).error([](const BrokenPromise&) {});
+    CHECK(retried.hasError());
+    std::move(retried).error([](const std::runtime_error& e) {
+      CHECK_EQUAL("nope", e.what());
+      return 0;
+    });
+    CHECK_PREV("nope");
+    promise.setValue(3);
+    CHECK_EQUAL(3, std::move(hedged).get());
+    CHECK_EQUAL(1, attempts);
+  }
+
+  {
+    // The same seed gives the same interleaving of the chains, and
+    // different seeds give different ones
+    auto schedule = [](uint64_t seed) {
+      Simulation sim(seed, std::chrono::microseconds(1));
+      SimulatedExecutor* a = sim.createExecutor();
+      SimulatedExecutor* b = sim.createExecutor();
+      std::string order;
+      for (char c = 'a'; c < 'e'; ++c) {
+        via(a, [&order, c] { order += c; })
+          .via(b)
+          .then([&order, c] { order += char(c - 'a' + 'A'); });
+      }
+      CHECK_EQUAL(8, sim.run());
+      CHECK_EQUAL(4, b->latencies().size());
+      return order;
+    };
+    CHECK_EQUAL(schedule(1), schedule(1));
+    CHECK_EQUAL(schedule(2), schedule(2));
+    std::set<std::string> schedules;
+    for (uint64_t seed = 0; seed < 8; ++seed)
+      schedules.insert(schedule(seed));
+    CHECK(schedules.size() > 1);
+    // The schedule only depends on the engine output, which the standard
+    // specifies exactly, so it's the same with every standard library
+    CHECK_EQUAL("aAbBcCdD", schedule(2));
+  }
+
+  {
+    Simulation sim(1);
+    SimulatedExecutor* executor = sim.createExecutor();
+    Simulation::Duration when{ 0 };
+    sim.after(std::chrono::seconds(10), executor).then([&sim, &when] { when = sim.now(); });
+    sim.run();
+    CHECK(when == std::chrono::seconds(10));
+  }
+
+  {
+    // Generic lambdas, function pointers, std::bind and lvalue functors
+    Promise<int> promise{ 5 };
+    auto add = [](int a, int b) { return a + b; };
+    auto toString = [](auto v) { return std::to_string(v); };
+    auto future = promise.future()
+                    .then([](auto v) { return v + 1; })
+                    .then(&twice)
+                    .then(std::bind(add, std::placeholders::_1, 3))
+                    .then(toString);
+    CHECK_EQUAL("15", std::move(future).get());
+
+    auto factory = [] { return 7; };
+    CHECK_EQUAL(7, via(&pool, factory).get());
+  }
+
+  {
+    // Generic error handlers get the std::exception_ptr
+    Promise<int> promise;
+    auto future = promise.future().error([](auto error) {
+      try {
+        std::rethrow_exception(error);
+      } catch (std::runtime_error& e) {
+        return int(std::string(e.what()).size());
+      }
+    });
+    promise.setError(std::runtime_error("four"));
+    CHECK_EQUAL(4, std::move(future).get());
+  }
+
+  {
+    // Destroying an unfulfilled promise breaks it
+    Future<int> future = Promise<int>().future();
+    CHECK(future.hasError());
+    auto recovered = std::move(future).error([](const BrokenPromise&) { return 3; });
+    CHECK_EQUAL(3, std::move(recovered).get());
+
+    // Also when only the attached continuations refer to the state
+    bool broken = false;
+    {
+      Promise<int> promise;
+      promise.future()
+        .then([](int v) { return v; })
+        .error([&broken](const BrokenPromise&) {
+          broken = true;
+          return 0;
+        });
+    }
+    CHECK(broken);
+    auto chained = [] {
+      Promise<int> promise;
+      return promise.future().then([](int v) { return v; });
+    }();
+    CHECK(chained.hasError());
+
+    int errors = 0;
+    {
+      Promise<> promise;
+      promise.future().error([&errors](std::exception_ptr) { ++errors; });
+      Promise<> other;
+      other.future().error([&errors](std::exception_ptr) { ++errors; });
+      // Fulfilled promises and moved-from promises don't break
+      promise.setValue();
+      Promise<> moved = std::move(other);
+      moved.setValue();
+    }
+    CHECK_EQUAL(0, errors);
+  }
+
+#ifdef PLEDGE_DEBUG_REGISTRY
+  {
+    Promise<int> promise;
+    int line = __LINE__ - 1;
+    auto future = promise.future().then([](int v) { return v; });
+    std::vector<FutureInfo> futures = liveFutures();
+    size_t found = 0;
+    for (const FutureInfo& info : futures)
+      if (info.file && info.line == line && std::string(info.state) == "waiting")
+        ++found;
+    CHECK_EQUAL(2, found);
+    promise.setValue(1);
+    CHECK_EQUAL(1, std::move(future).get());
+
+    // Destroyed futures leave nothing behind
+    size_t before = liveFutures().size();
+    for (int i = 0; i < 100; ++i) {
+      Promise<int> promise;
+      auto future = promise.future().then([](int v) { return v; });
+      promise.setValue(i);
+    }
+    CHECK_EQUAL(before, liveFutures().size());
+  }
+#endif
+
+  {
+    // Tasks of a SerialExecutor don't overlap and keep their order
+    SerialExecutor serial(&pool, 4);
+    std::atomic<int> running{ 0 };
+    std::atomic<bool> overlap{ false };
+    std::vector<int> order;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+      threads.emplace_back([&, t] {
+        for (int i = 0; i < 250; ++i) {
+          serial.add([&, t, i] {
+            if (running.fetch_add(1))
+              overlap = true;
+            order.push_back(t * 1000 + i);
+            running.fetch_sub(1);
+          });
+        }
+      });
+    }
+    for (std::thread& t : threads)
+      t.join();
+    CHECK(via(&serial, [&serial] { return Executor::current() == &serial; }).get());
+    CHECK(!overlap.load());
+    CHECK_EQUAL(1000, order.size());
+    std::array<int, 4> last{ -1, -1, -1, -1 };
+    bool ordered = true;
+    for (int v : order) {
+      ordered = ordered && v % 1000 > last[v / 1000];
+      last[v / 1000] = v % 1000;
+    }
+    CHECK(ordered);
+  }
+
+  {
+    // A batch schedules a single drain task to the parent
+    ManualExecutor manual;
+    SerialExecutor serial(&manual);
+    std::string order;
+    std::vector<Executor::Func> batch;
+    for (char c = 'a'; c < 'e'; ++c)
+      batch.push_back([&order, c] { order += c; });
+    serial.addBatch(std::move(batch));
+    CHECK_EQUAL(1, manual.run());
+    CHECK_EQUAL("abcd", order);
+  }
+
+  {
+    // Waiting in a SerialExecutor task helps the parent with BlockingPolicy::Help
+    ThreadPoolExecutor single{ 1 };
+    single.setBlockingPolicy(Executor::BlockingPolicy::Help);
+    SerialExecutor serial(&single);
+    auto future = via(&serial, [&single] {
+      return via(&single, [] { return 1; }).get() + 1;
+    });
+    CHECK_EQUAL(2, std::move(future).get());
+
+    // A helped parent task doesn't run as part of the strand, so strand
+    // continuations it triggers are queued instead of nested in the waiting task
+    Promise<> strandPromise;
+    bool inTask = false;
+    bool overlapped = false;
+    auto continuation = strandPromise.future(&serial).then([&] { overlapped = inTask; });
+    auto helping = via(&serial, [&] {
+      inTask = true;
+      via(&single, [&] { strandPromise.setValue(); }).get();
+      inTask = false;
+    });
+    std::move(helping).get();
+    std::move(continuation).get();
+    CHECK(!overlapped);
+  }
+
+  {
+    // At most maxInFlight calls run at the same time and the results keep
+    // the input order
+    std::vector<int> input(200);
+    std::iota(input.begin(), input.end(), 0);
+    std::atomic<int> running{ 0 };
+    std::atomic<int> maxRunning{ 0 };
+    auto results = window(&pool, input, 3, [&](int v) {
+                     int now = ++running;
+                     int prev = maxRunning.load();
+                     while (now > prev && !maxRunning.compare_exchange_weak(prev, now))
+                       ;
+                     std::this_thread::yield();
+                     --running;
+                     return v * 2;
+                   }).get();
+    CHECK_EQUAL(200, results.size());
+    bool ordered = true;
+    for (int i = 0; i < int(results.size()); ++i)
+      ordered = ordered && results[i] == i * 2;
+    CHECK(ordered);
+    CHECK(maxRunning.load() <= 3);
+
+    std::atomic<int> sum{ 0 };
+    window(&pool, input, 8, [&sum](int v) { sum += v; }).get();
+    CHECK_EQUAL(199 * 100, sum.load());
+  }
+
+  {
+    // Returned futures count as in flight until they are ready
+    std::vector<Promise<int>> promises;
+    promises.reserve(10);
+    auto future = window(
+      nullptr,
+      std::vector<int>(10),
+      3,
+      [&promises](int) {
+        promises.emplace_back();
+        return promises.back().future();
+      },
+      WindowOrder::Unordered);
+    CHECK_EQUAL(3, promises.size());
+    promises[1].setValue(1);
+    CHECK_EQUAL(4, promises.size());
+    for (size_t i = 0; i < promises.size(); ++i)
+      if (i != 1)
+        promises[i].setValue(int(i));
+    CHECK_EQUAL(10, promises.size());
+    std::vector<int> results = std::move(future).get();
+    CHECK_EQUAL(10, results.size());
+    CHECK_EQUAL(1, results[0]);
+  }
+
+  {
+    // The first error stops starting new items
+    int calls = 0;
+    auto future = window(nullptr, std::vector<int>{ 1, 2, 3, 4, 5 }, 2, [&calls](int v) {
+      ++calls;
+      if (v == 2)
+        throw std::runtime_error("window");
+      return v;
+    });
+    CHECK(future.hasError());
+    CHECK_EQUAL(2, calls);
+
+    // also when f throws instead of returning a future
+    calls = 0;
+    auto thrown = window(nullptr, std::vector<int>{ 1, 2, 3, 4, 5 }, 2, [&calls](int v) {
+      ++calls;
+      if (v == 2)
+        throw std::runtime_error("window");
+      return makeReadyFuture(v);
+    });
+    CHECK(thrown.hasError());
+    CHECK_EQUAL(2, calls);
+  }
+
+  {
+    // In order, a finished item keeps its place in the window until the
+    // earlier items have finished, so only maxInFlight results are buffered
+    std::vector<Promise<int>> promises;
+    promises.reserve(10);
+    auto future = window(nullptr, std::vector<int>(10), 3, [&promises](int) {
+      promises.emplace_back();
+      return promises.back().future();
+    });
+    CHECK_EQUAL(3, promises.size());
+    promises[2].setValue(2);
+    promises[1].setValue(1);
+    CHECK_EQUAL(3, promises.size());
+    promises[0].setValue(0);
+    CHECK_EQUAL(6, promises.size());
+    for (size_t i = 3; i < promises.size(); ++i)
+      promises[i].setValue(int(i));
+    CHECK_EQUAL(10, promises.size());
+    std::vector<int> results = std::move(future).get();
+    std::vector<int> expected(10);
+    std::iota(expected.begin(), expected.end(), 0);
+    CHECK(results == expected);
+  }
+
   return 0;
 }
@@ -1,61 +1,201 @@
 #pragma once
 
-#include <condition_variable>
+#include <algorithm>
+#include <atomic>
+#include <memory>
 #include <mutex>
 #include <queue>
 #include <thread>
 #include <vector>
 
 #include "Executor.hpp"
+#include "details/EventCount.hpp"
 
 namespace Pledge {
 
+// Runs tasks in a fixed number of worker threads.
+//
+// Tasks are queued to one or more shards, each protected by its own mutex.
+// With a single shard the tasks are run in the order they were added. With
+// many threads adding tasks at the same time, more shards reduce the lock
+// contention: each adding thread is assigned to one of the shards, and idle
+// workers take tasks from all of them. Tasks added from the same thread are
+// still started in order, but there is no ordering between threads.
 class ThreadPoolExecutor : public Executor
 {
 public:
   inline void add(Func func) override
   {
+    Shard& shard = producerShard();
     {
-      std::lock_guard<std::mutex> g(m_queueMutex);
-      m_queue.push(std::move(func));
+      std::lock_guard<std::mutex> g(shard.mutex);
+      shard.queue.push(std::move(func));
     }
-    m_queueCond.notify_one();
+    m_events.notify();
   }
 
-  inline ThreadPoolExecutor(size_t threadCount = 8)
+  // Queues all tasks with a single lock and wakes up at most as many idle
+  // workers as there are new tasks.
+  inline void addBatch(std::vector<Func> funcs) override
+  {
+    Shard& shard = producerShard();
+    {
+      std::lock_guard<std::mutex> g(shard.mutex);
+      for (Func& func : funcs)
+        shard.queue.push(std::move(func));
+    }
+    m_events.notify(funcs.size());
+  }
+
+  // Continuations that are triggered by a task in this pool can continue
+  // in the same worker thread.
+  inline bool canRunInline() const override { return current() == this; }
+
+  inline BlockingPolicy blockingPolicy() const override
+  {
+    return m_blockingPolicy.load(std::memory_order_relaxed);
+  }
+
+  // Sets what Future::get() does when called from a worker thread of this
+  // pool. The default is BlockingPolicy::Block.
+  inline void setBlockingPolicy(BlockingPolicy policy)
+  {
+    m_blockingPolicy.store(policy, std::memory_order_relaxed);
+  }
+
+  inline bool tryRunOne() override
+  {
+    Func func;
+    if (!tryPop(producerShardIndex(), func))
+      return false;
+    runHelped(func);
+    return true;
+  }
+
+  // Sleeps like an idle worker when there is nothing to run, and wakes up
+  // for new tasks and for wakeHelpers().
+  inline void helpUntil(const std::function<bool()>& ready) override
+  {
+    while (!ready()) {
+      Func func;
+      if (!tryPop(producerShardIndex(), func)) {
+        uint64_t key = m_events.prepareWait();
+        if (ready()) {
+          m_events.cancelWait();
+          return;
+        }
+        if (!tryPop(producerShardIndex(), func)) {
+          m_events.wait(key);
+          continue;
+        }
+        m_events.cancelWait();
+      }
+      runHelped(func);
+    }
+  }
+
+  // Also wakes idle workers, they just go back to sleep
+  inline void wakeHelpers() override { m_events.notifyAll(); }
+
+  inline ThreadPoolExecutor(size_t threadCount = 8, size_t shardCount = 1)
+    : m_shards(new Shard[std::max<size_t>(shardCount, 1)])
+    , m_shardCount(std::max<size_t>(shardCount, 1))
   {
     m_threads.reserve(threadCount);
     for (size_t i = 0; i < threadCount; ++i)
-      m_threads.emplace_back(std::bind(&ThreadPoolExecutor::exec, this));
+      m_threads.emplace_back(std::bind(&ThreadPoolExecutor::exec, this, i % m_shardCount));
   }
 
   inline ~ThreadPoolExecutor()
   {
-    {
-      std::unique_lock<std::mutex> lock(m_queueMutex);
-      m_running = false;
-    }
-    m_queueCond.notify_all();
+    m_running.store(false);
+    m_events.notifyAll();
 
     for (std::thread& t : m_threads)
       t.join();
   }
 
 private:
-  inline void exec()
+  // Aligned to avoid false sharing between the shard mutexes
+  struct alignas(64) Shard
+  {
+    std::mutex mutex;
+    std::queue<Func> queue;
+  };
+
+  // Each thread that adds tasks sticks to the same shard of each pool. The
+  // shards of a pool are handed out round robin, in the order the threads
+  // first add to it.
+  inline size_t producerShardIndex()
+  {
+    if (m_shardCount == 1)
+      return 0;
+
+    struct Producer
+    {
+      const ThreadPoolExecutor* pool;
+      // Tells apart a destroyed pool and a new one at the same address
+      std::weak_ptr<void> alive;
+      size_t shard;
+    };
+    thread_local std::vector<Producer> t_producers;
+
+    for (const Producer& producer : t_producers)
+      if (producer.pool == this && !producer.alive.expired())
+        return producer.shard;
+
+    t_producers.erase(std::remove_if(t_producers.begin(),
+                                     t_producers.end(),
+                                     [](const Producer& p) { return p.alive.expired(); }),
+                      t_producers.end());
+    size_t shard = m_nextProducer.fetch_add(1, std::memory_order_relaxed) % m_shardCount;
+    t_producers.push_back({ this, m_alive, shard });
+    return shard;
+  }
+
+  inline Shard& producerShard() { return m_shards[producerShardIndex()]; }
+
+  // Runs a task from another executor's thread
+  inline void runHelped(Func& func)
+  {
+    // The task belongs to this pool even when helped from another executor
+    CurrentScope scope(this);
+    func();
+  }
+
+  // Takes a task from the first non-empty shard, starting from 'first'
+  inline bool tryPop(size_t first, Func& func)
   {
+    for (size_t i = 0; i < m_shardCount; ++i) {
+      Shard& shard = m_shards[(first + i) % m_shardCount];
+      std::lock_guard<std::mutex> g(shard.mutex);
+      if (!shard.queue.empty()) {
+        func = std::move(shard.queue.front());
+        shard.queue.pop();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  inline void exec(size_t homeShard)
+  {
+    CurrentScope scope(this);
     for (;;) {
       Func func;
-      {
-        std::unique_lock<std::mutex> lock(m_queueMutex);
-        while (m_running && m_queue.empty())
-          m_queueCond.wait(lock);
-
-        if (m_queue.empty())
+      if (!tryPop(homeShard, func)) {
+        // Check the running flag only after registering as a waiter, so that
+        // the destructor either sees the waiter or we see the flag.
+        uint64_t key = m_events.prepareWait();
+        if (tryPop(homeShard, func)) {
+          m_events.cancelWait();
+        } else if (!m_running.load()) {
+          m_events.cancelWait();
           break;
-
-        func = std::move(m_queue.front());
-        m_queue.pop();
+        } else {
+          m_events.wait(key);
+          continue;
+        }
       }
       func();
     }
@@ -63,10 +203,14 @@ private:
 
 private:
   std::vector<std::thread> m_threads;
-  std::queue<Func> m_queue;
-  std::mutex m_queueMutex;
-  std::condition_variable m_queueCond;
-  bool m_running = true;
+  std::unique_ptr<Shard[]> m_shards;
+  size_t m_shardCount;
+  std::atomic<size_t> m_nextProducer{ 0 };
+  // Expires when the pool is destroyed, see producerShardIndex()
+  std::shared_ptr<void> m_alive = std::make_shared<char>();
+  Impl::EventCount m_events;
+  std::atomic<BlockingPolicy> m_blockingPolicy{ BlockingPolicy::Block };
+  std::atomic<bool> m_running{ true };
 };
 
 }
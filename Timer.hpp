@@ -0,0 +1,148 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Promise.hpp"
+
+namespace Pledge {
+
+// Timer runs delayed tasks in a single dedicated thread. Waiting for a timer
+// doesn't block any executor threads, so it can be used to implement delays
+// between asynchronous operations.
+//
+// Tasks that haven't been called when the timer is destroyed are discarded,
+// so futures returned by after() fail with BrokenPromise.
+class Timer
+{
+public:
+  using Clock = std::chrono::steady_clock;
+  // Identifies a scheduled task for cancel()
+  using TaskId = uint64_t;
+
+  inline Timer()
+    : m_thread(std::bind(&Timer::exec, this))
+  {}
+
+  inline ~Timer()
+  {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_running = false;
+    }
+    m_cond.notify_all();
+    m_thread.join();
+  }
+
+  Timer(const Timer&) = delete;
+  Timer& operator=(const Timer&) = delete;
+
+  // Calls 'func' in the timer thread once 'time' has been reached. Tasks
+  // with the same time are called in the order they were scheduled.
+  inline TaskId schedule(Clock::time_point time, Executor::Func func)
+  {
+    TaskId id;
+    bool first = false;
+    {
+      std::lock_guard<std::mutex> g(m_mutex);
+      id = m_seq++;
+      m_queue.push_back({ time, id, std::move(func) });
+      std::push_heap(m_queue.begin(), m_queue.end(), Later());
+      first = m_queue.front().seq == id;
+    }
+    // Only need to wake up the thread if it is now waiting for a wrong time
+    if (first)
+      m_cond.notify_one();
+    return id;
+  }
+
+  // Removes a task that hasn't been called yet, which releases everything
+  // it captured. Returns false if the task has already been called or
+  // cancelled.
+  inline bool cancel(TaskId id)
+  {
+    // Destroyed after the lock is released, the task may own promises
+    Executor::Func func;
+    std::lock_guard<std::mutex> g(m_mutex);
+    auto it = std::find_if(
+      m_queue.begin(), m_queue.end(), [id](const Entry& entry) { return entry.seq == id; });
+    if (it == m_queue.end())
+      return false;
+    func = std::move(it->func);
+    *it = std::move(m_queue.back());
+    m_queue.pop_back();
+    std::make_heap(m_queue.begin(), m_queue.end(), Later());
+    // The thread might now wait for an earlier time than needed, which is
+    // harmless, it just waits again
+    return true;
+  }
+
+  // Returns a future that becomes ready after 'delay'. Continuations are
+  // called in the timer thread unless another executor is given, so they
+  // should be cheap or jump to another executor.
+  inline Future<> after(Clock::duration delay, Executor* executor = nullptr)
+  {
+    auto promise = std::make_shared<Promise<>>();
+    Future<> future = promise->future(executor);
+    schedule(Clock::now() + delay, [promise] { promise->setValue(); });
+    return future;
+  }
+
+private:
+  struct Entry
+  {
+    Clock::time_point time;
+    uint64_t seq;
+    Executor::Func func;
+  };
+
+  // Makes std::push_heap build a min-heap
+  struct Later
+  {
+    inline bool operator()(const Entry& a, const Entry& b) const
+    {
+      return a.time == b.time ? a.seq > b.seq : a.time > b.time;
+    }
+  };
+
+  inline void exec()
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_running) {
+      if (m_queue.empty()) {
+        m_cond.wait(lock);
+        continue;
+      }
+
+      Clock::time_point time = m_queue.front().time;
+      if (Clock::now() < time) {
+        m_cond.wait_until(lock, time);
+        continue;
+      }
+
+      std::pop_heap(m_queue.begin(), m_queue.end(), Later());
+      Executor::Func func = std::move(m_queue.back().func);
+      m_queue.pop_back();
+
+      lock.unlock();
+      func();
+      // Release the captures before locking, like cancel() does
+      func = nullptr;
+      lock.lock();
+    }
+  }
+
+private:
+  std::vector<Entry> m_queue;
+  std::mutex m_mutex;
+  std::condition_variable m_cond;
+  uint64_t m_seq = 0;
+  bool m_running = true;
+  std::thread m_thread;
+};
+
+}
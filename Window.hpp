@@ -0,0 +1,61 @@
+#pragma once
+
+#include <iterator>
+#include <vector>
+
+#include "Promise.hpp"
+
+namespace Pledge {
+
+// Result order of window()
+enum class WindowOrder
+{
+  // Results are in the same order as the input items
+  Ordered,
+  // Results are in the order the items completed
+  Unordered
+};
+
+namespace Impl {
+
+template <typename Range, typename F>
+struct WindowTypes
+{
+  using Iterator = decltype(std::begin(std::declval<Range&>()));
+  using Item = decltype(*std::declval<Iterator&>());
+  // Value of a single item, f can return either a value or a future
+  using Value = typename FutureTypeT<std::invoke_result_t<std::decay_t<F>&, Item>>::FutureValueType;
+  // Value of the returned future
+  using Result = std::conditional_t<std::is_void_v<Value>, void, std::vector<Value>>;
+};
+
+} // namespace Impl
+
+// Calls 'f' for each item of 'range' in 'executor', with at most
+// 'maxInFlight' calls, or futures returned by them, unfinished at the same
+// time. The next item is started as soon as an earlier one finishes, so the
+// number of pending tasks and futures stays constant no matter how large
+// the range is.
+//
+// Returns a future with a vector of the results, or a void future if 'f'
+// doesn't return anything. With WindowOrder::Ordered, a finished item keeps
+// its place in the window until the earlier items have finished, so at most
+// 'maxInFlight' results wait to be put in order besides the returned vector.
+// If any item fails, no more items are started and the future gets the
+// first error once the started items have finished.
+//
+// Items are passed to 'f' by reference from the range. A temporary range is
+// moved to the operation, otherwise the range must stay alive until the
+// returned future is ready. 'f' can be called from several threads at the
+// same time.
+template <typename Range, typename F>
+auto window(Executor* executor,
+            Range&& range,
+            size_t maxInFlight,
+            F&& f,
+            WindowOrder order = WindowOrder::Ordered)
+  -> FutureType<typename Impl::WindowTypes<Range, F>::Result>;
+
+}
+
+#include "details/WindowImpl.hpp"
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+namespace Pledge {
+
+// Snapshot of a live future shared state, see liveFutures().
+struct FutureInfo
+{
+  // Value type as given by typeid, mangled on most compilers
+  const char* type = nullptr;
+  // Where the promise that started the chain was created, or null if unknown
+  const char* file = nullptr;
+  int line = 0;
+  std::chrono::steady_clock::duration age{};
+  // "waiting", "value" or "error"
+  const char* state = nullptr;
+};
+
+namespace Impl {
+
+// Source location of a call, captured with a default argument:
+//   void f(Site site = Site::current());
+struct Site
+{
+  const char* file;
+  int line;
+
+  static inline Site current(const char* file = __builtin_FILE(), int line = __builtin_LINE())
+  {
+    return { file, line };
+  }
+};
+
+// Registry of live FutureData objects, filled only when PLEDGE_DEBUG_REGISTRY
+// is defined. Each object embeds an Entry that links itself to an intrusive
+// list when the object is created and unlinks itself when it's destroyed, so
+// the registry never holds more than the live objects.
+class DebugRegistry
+{
+public:
+  enum State
+  {
+    Waiting,
+    Value,
+    Error
+  };
+
+  class Entry
+  {
+  public:
+    inline explicit Entry(const char* type)
+      : type(type)
+      , created(std::chrono::steady_clock::now())
+    {
+      DebugRegistry::instance().add(this);
+    }
+
+    inline ~Entry() { DebugRegistry::instance().remove(this); }
+
+    Entry(const Entry&) = delete;
+    Entry& operator=(const Entry&) = delete;
+
+    // Called at most once, before or after the entry is published
+    inline void setSite(Site site)
+    {
+      file = site.file;
+      line = site.line;
+      hasSite.store(true, std::memory_order_release);
+    }
+
+    const char* const type;
+    const std::chrono::steady_clock::time_point created;
+    std::atomic<int> state{ Waiting };
+    std::atomic<bool> hasSite{ false };
+    const char* file = nullptr;
+    int line = 0;
+
+  private:
+    friend class DebugRegistry;
+
+    // Protected by the registry mutex
+    Entry* prev = nullptr;
+    Entry* next = nullptr;
+  };
+
+  // Never destroyed, since futures can outlive static destructors
+  static inline DebugRegistry& instance()
+  {
+    static DebugRegistry* s_registry = new DebugRegistry();
+    return *s_registry;
+  }
+
+  inline std::vector<FutureInfo> live()
+  {
+    static const char* const s_states[] = { "waiting", "value", "error" };
+
+    std::lock_guard<std::mutex> g(m_mutex);
+    std::vector<FutureInfo> ret;
+    auto now = std::chrono::steady_clock::now();
+    for (Entry* e = m_head; e; e = e->next) {
+      FutureInfo info;
+      info.type = e->type;
+      if (e->hasSite.load(std::memory_order_acquire)) {
+        info.file = e->file;
+        info.line = e->line;
+      }
+      info.age = now - e->created;
+      info.state = s_states[e->state.load(std::memory_order_relaxed)];
+      ret.push_back(info);
+    }
+    return ret;
+  }
+
+private:
+  inline void add(Entry* entry)
+  {
+    std::lock_guard<std::mutex> g(m_mutex);
+    entry->next = m_head;
+    if (m_head)
+      m_head->prev = entry;
+    m_head = entry;
+  }
+
+  inline void remove(Entry* entry)
+  {
+    std::lock_guard<std::mutex> g(m_mutex);
+    if (entry->prev)
+      entry->prev->next = entry->next;
+    else
+      m_head = entry->next;
+    if (entry->next)
+      entry->next->prev = entry->prev;
+  }
+
+  Entry* m_head = nullptr;
+  std::mutex m_mutex;
+};
+
+} // namespace Impl
+
+// Returns all future shared states that are alive, newest first. Only
+// futures created while PLEDGE_DEBUG_REGISTRY is defined are tracked, so this
+// is empty in normal builds. Waiting entries that keep getting older point
+// to promises that are never fulfilled or chains that are never consumed.
+inline std::vector<FutureInfo> liveFutures()
+{
+  return Impl::DebugRegistry::instance().live();
+}
+
+// Prints liveFutures() to 'out', one line per entry
+inline void dumpLiveFutures(FILE* out = stderr)
+{
+  std::vector<FutureInfo> futures = liveFutures();
+  fprintf(out, "%zu live futures\n", futures.size());
+  for (const FutureInfo& info : futures) {
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(info.age).count();
+    fprintf(out,
+            "  %s %s, age %lld ms, created at %s:%d\n",
+            info.state,
+            info.type,
+            static_cast<long long>(ms),
+            info.file ? info.file : "?",
+            info.line);
+  }
+}
+
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+namespace Pledge {
+namespace Impl {
+
+// Lets threads sleep until some condition becomes true, without the threads
+// making the condition true having to take a lock unless someone is actually
+// sleeping. A waiter does:
+//
+//   if (tryGetWork()) ...
+//   uint64_t key = events.prepareWait();
+//   if (tryGetWork()) { events.cancelWait(); ... }
+//   else events.wait(key);
+//
+// and the other side makes work available and then calls notify().
+class EventCount
+{
+public:
+  inline uint64_t prepareWait()
+  {
+    m_waiters.fetch_add(1, std::memory_order_seq_cst);
+    return m_epoch.load(std::memory_order_seq_cst);
+  }
+
+  inline void cancelWait() { m_waiters.fetch_sub(1, std::memory_order_seq_cst); }
+
+  // Sleeps until notify() has been called after prepareWait() returned 'key'
+  inline void wait(uint64_t key)
+  {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      while (m_epoch.load(std::memory_order_relaxed) == key)
+        m_cond.wait(lock);
+    }
+    m_waiters.fetch_sub(1, std::memory_order_seq_cst);
+  }
+
+  // Wakes up at most 'count' waiters. Returns immediately if nobody is
+  // waiting.
+  inline void notify(size_t count = 1)
+  {
+    // Pairs with the fetch_add in prepareWait, so that either the waiter
+    // sees the new work or we see the waiter. A read-modify-write instead of
+    // a fence, since ThreadSanitizer doesn't understand fences.
+    size_t waiters = m_waiters.fetch_add(0, std::memory_order_seq_cst);
+    if (waiters == 0 || count == 0)
+      return;
+
+    {
+      std::lock_guard<std::mutex> g(m_mutex);
+      m_epoch.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (count >= waiters) {
+      m_cond.notify_all();
+    } else {
+      for (size_t i = 0; i < count; ++i)
+        m_cond.notify_one();
+    }
+  }
+
+  inline void notifyAll() { notify(SIZE_MAX); }
+
+  // Number of threads in prepareWait() or wait()
+  inline size_t waiters() const { return m_waiters.load(std::memory_order_seq_cst); }
+
+private:
+  std::atomic<size_t> m_waiters{ 0 };
+  std::atomic<uint64_t> m_epoch{ 0 };
+  std::mutex m_mutex;
+  std::condition_variable m_cond;
+};
+
+} // namespace Impl
+}
@@ -1,9 +1,17 @@
 #pragma once
 
+#include <atomic>
 #include <cassert>
-#include <mutex>
-#include <variant>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <thread>
+#include <typeinfo>
 
+#include "../Executor.hpp"
+#include "DebugRegistry.hpp"
+#include "InlineFunction.hpp"
+#include "Pool.hpp"
 #include "Traits.hpp"
 
 namespace Pledge {
@@ -13,6 +21,38 @@ namespace Pledge {
 struct void_type
 {};
 
+// ThenRet<F, T> is the return type of a then() continuation 'f' for
+// a Future<T>. Continuations of void futures are called without arguments.
+// The value is passed as an rvalue, or as an lvalue to continuations that
+// take T&.
+template <typename F, typename T, typename S = void>
+struct ThenRetT
+{
+  using Type = std::invoke_result_t<std::decay_t<F>&, T&>;
+};
+
+template <typename F, typename T>
+struct ThenRetT<
+  F,
+  T,
+  std::enable_if_t<!std::is_same_v<T, void_type> && std::is_invocable_v<std::decay_t<F>&, T&&>>>
+{
+  using Type = std::invoke_result_t<std::decay_t<F>&, T&&>;
+};
+
+template <typename F>
+struct ThenRetT<F, void>
+{
+  using Type = std::invoke_result_t<std::decay_t<F>&>;
+};
+
+template <typename F>
+struct ThenRetT<F, void_type> : ThenRetT<F, void>
+{};
+
+template <typename F, typename T>
+using ThenRet = typename ThenRetT<F, T>::Type;
+
 // Forward declarations
 
 template <typename T = void>
@@ -69,27 +109,150 @@ using FutureType = Future<typename FutureTypeT<T>::FutureValueType>;
 
 // This is the shared state between a promise and a future. Each link in a
 // continuation chain has its own Future and own FutureData.
+//
+// There can be millions of these alive at the same time, so the layout is
+// kept compact: the executor pointer, the state and a spinlock bit are packed
+// into a single word, the value and the error share the same storage and
+// the callback is stored inline. The whole object for small value types
+// fits in one cache line.
 template <typename T>
 class FutureData
 {
 public:
-  FutureData() = default;
-
-  template <typename Y>
-  FutureData(Y&& t);
-
-  // Indexes to m_value
-  enum State : size_t
+  // Values of the state bits
+  enum State : uintptr_t
   {
     Waiting = 0,
     Value = 1,
     Error = 2
   };
 
-  std::mutex mutex;
-  std::variant<std::monostate, T, std::exception_ptr> value;
-  Executor* executor = nullptr;
-  std::function<void()> callback;
+  // Fits a callback capturing a shared pointer and a functor with two
+  // pointer-sized captures
+  static constexpr size_t CallbackSize = 32;
+
+  inline FutureData() {}
+
+  template <typename Y>
+  FutureData(Y&& t);
+
+  inline ~FutureData()
+  {
+    State s = state();
+    if (s == Value)
+      m_value.~T();
+    else if (s == Error)
+      m_error.~exception_ptr();
+  }
+
+  FutureData(const FutureData&) = delete;
+  FutureData& operator=(const FutureData&) = delete;
+
+  // Spinlock that protects the state and the callback. FutureData is
+  // BasicLockable, so it can be used with std::unique_lock and
+  // std::condition_variable_any.
+  inline void lock()
+  {
+    for (unsigned spins = 0; m_bits.fetch_or(LockBit, std::memory_order_acquire) & LockBit;) {
+      while (m_bits.load(std::memory_order_relaxed) & LockBit)
+        if (++spins > 64)
+          std::this_thread::yield();
+    }
+  }
+
+  inline void unlock() { m_bits.fetch_and(~LockBit, std::memory_order_release); }
+
+  inline State state() const { return State(m_bits.load(std::memory_order_acquire) & StateMask); }
+
+  inline Executor* executor() const
+  {
+    return reinterpret_cast<Executor*>(m_bits.load(std::memory_order_acquire) & PointerMask);
+  }
+
+  inline void setExecutor(Executor* executor)
+  {
+    uintptr_t ptr = reinterpret_cast<uintptr_t>(executor);
+    uintptr_t bits = m_bits.load(std::memory_order_relaxed);
+    while (!m_bits.compare_exchange_weak(
+      bits, (bits & ~PointerMask) | ptr, std::memory_order_release))
+      ;
+  }
+
+  // Only valid when state() is Value
+  inline T& value() { return m_value; }
+  // Only valid when state() is Error
+  inline std::exception_ptr& error() { return m_error; }
+
+  // These can be called only once, while holding the lock
+  template <typename Y>
+  void emplaceValue(Y&& y)
+  {
+    new (&m_value) T(std::forward<Y>(y));
+    m_bits.fetch_or(Value, std::memory_order_release);
+#ifdef PLEDGE_DEBUG_REGISTRY
+    m_debug.state.store(Impl::DebugRegistry::Value, std::memory_order_relaxed);
+#endif
+  }
+
+  inline void emplaceError(std::exception_ptr error)
+  {
+    new (&m_error) std::exception_ptr(std::move(error));
+    m_bits.fetch_or(Error, std::memory_order_release);
+#ifdef PLEDGE_DEBUG_REGISTRY
+    m_debug.state.store(Impl::DebugRegistry::Error, std::memory_order_relaxed);
+#endif
+  }
+
+  // Creation site shown by liveFutures(). Does nothing unless
+  // PLEDGE_DEBUG_REGISTRY is defined.
+  inline void setSite([[maybe_unused]] Impl::Site site)
+  {
+#ifdef PLEDGE_DEBUG_REGISTRY
+    m_debug.setSite(site);
+#endif
+  }
+
+  // Copies the creation site from the previous link of a chain
+  template <typename Y>
+  void inheritSite([[maybe_unused]] const FutureData<Y>& from)
+  {
+#ifdef PLEDGE_DEBUG_REGISTRY
+    if (from.m_debug.hasSite.load(std::memory_order_acquire))
+      m_debug.setSite({ from.m_debug.file, from.m_debug.line });
+#endif
+  }
+
+  // Continuation that is called once the value or the error is set. Only
+  // one of 'value' and 'error' is non-null, and the callback is allowed to
+  // move it. The value is not stored in FutureData before calling the
+  // callback, that is up to the callback if it needs to.
+  using Callback =
+    void(const std::shared_ptr<FutureData>& self, T* value, std::exception_ptr* error);
+  Impl::InlineFunction<Callback, CallbackSize> callback;
+
+private:
+  template <typename Y>
+  friend class FutureData;
+
+  static constexpr uintptr_t StateMask = 3;
+  static constexpr uintptr_t LockBit = 4;
+  static constexpr uintptr_t PointerMask = ~uintptr_t(7);
+  static_assert(alignof(Executor) > LockBit, "Executor pointers need to have free bits");
+
+  std::atomic<uintptr_t> m_bits{ Waiting };
+  union
+  {
+    T m_value;
+    std::exception_ptr m_error;
+  };
+#ifdef PLEDGE_DEBUG_REGISTRY
+  Impl::DebugRegistry::Entry m_debug{ typeid(T).name() };
+#endif
 };
 
+#ifndef PLEDGE_DEBUG_REGISTRY
+// Guard against accidentally growing the per-link memory usage
+static_assert(sizeof(FutureData<int>) <= 64, "FutureData<int> should fit in a cache line");
+#endif
+
 }
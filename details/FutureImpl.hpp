@@ -1,158 +1,456 @@
+#include <chrono>
 #include <condition_variable>
+#include <mutex>
 
 namespace Pledge {
 namespace Impl {
 
+// Continuations running inline in executor threads can trigger more
+// continuations, so limit the recursion depth.
+constexpr int MaxInlineDepth = 16;
+inline thread_local int t_inlineDepth = 0;
+
+// If a continuation has already been registered, the value is handed
+// directly to it without storing it to 'data' first.
 template <typename T, typename Y>
-void setValue(FutureData<T>& data, Y&& y)
+void setValue(const std::shared_ptr<FutureData<T>>& data, Y&& y)
 {
   {
-    std::unique_lock<std::mutex> lock(data.mutex);
-    data.value.template emplace<FutureData<T>::Value>(std::forward<Y>(y));
+    std::lock_guard<FutureData<T>> g(*data);
+    if (!data->callback) {
+      data->emplaceValue(std::forward<Y>(y));
+      return;
+    }
+  }
+  // callback can't be reassigned once it's set, no need to hold the lock
+  if constexpr (std::is_same_v<Y, T>) {
+    data->callback(data, &y, nullptr);
+  } else {
+    T tmp(std::forward<Y>(y));
+    data->callback(data, &tmp, nullptr);
   }
-  // callback can't be assigned after value is set, no need to hold mutex
-  if (data.callback)
-    data.callback();
 }
 
 template <typename T>
-void setError(FutureData<T>& data, std::exception_ptr error)
+void setError(const std::shared_ptr<FutureData<T>>& data, std::exception_ptr error)
 {
   {
-    std::unique_lock<std::mutex> lock(data.mutex);
-    data.value.template emplace<FutureData<T>::Error>(std::move(error));
+    std::lock_guard<FutureData<T>> g(*data);
+    if (!data->callback) {
+      data->emplaceError(std::move(error));
+      return;
+    }
+  }
+  data->callback(data, nullptr, &error);
+}
+
+// Stores a value or an error that was handed to a continuation, so that it
+// can be read later from another thread.
+template <typename T>
+void store(FutureData<T>& data, T* value, std::exception_ptr* error)
+{
+  std::lock_guard<FutureData<T>> g(data);
+  if (value)
+    data.emplaceValue(std::move(*value));
+  else
+    data.emplaceError(std::move(*error));
+}
+
+// Gives the implementation access to the internals of a future
+struct FutureAccess
+{
+  template <typename F>
+  static auto& data(F& future)
+  {
+    return future.m_data;
+  }
+
+  template <typename F>
+  static auto& ready(F& future)
+  {
+    return future.m_ready;
+  }
+
+  template <typename F>
+  static constexpr bool inlineReady = std::decay_t<F>::InlineReady;
+
+  // Future<void> is a Future<void_type> underneath
+  static Future<void_type>&& base(Future<void>&& future) { return std::move(future); }
+
+  template <typename T>
+  static Future<T>&& base(Future<T>&& future)
+  {
+    return std::move(future);
+  }
+
+  static Future<void> fromBase(Future<void_type>&& base) { return Future<void>(std::move(base)); }
+
+  // Returns a future with 'error' and 'executor' without shared state
+  template <typename F>
+  static F readyError(std::exception_ptr error, Executor* executor)
+  {
+    if constexpr (std::is_same_v<F, Future<void>>) {
+      return F(readyError<Future<void_type>>(std::move(error), executor));
+    } else {
+      F future(std::shared_ptr<FutureDataType<typename F::ValueType>>{});
+      future.m_ready.template emplace<ReadyError>(std::move(error));
+      future.m_executor = executor;
+      return future;
+    }
+  }
+};
+
+// Forwards the value or the error of the 'inner' future returned by
+// a continuation directly to 'to', without a then/error pair in between.
+template <typename F, typename T>
+void splice(F&& inner, const std::shared_ptr<FutureData<T>>& to)
+{
+  std::shared_ptr<FutureData<T>>& data = FutureAccess::data(inner);
+  if (!data) {
+    auto& ready = FutureAccess::ready(inner);
+    if constexpr (FutureAccess::inlineReady<F>) {
+      if (ready.index() == ReadyValue) {
+        setValue(to, std::move(std::get<ReadyValue>(ready)));
+        return;
+      }
+    }
+    setError(to, std::move(std::get<ReadyError>(ready)));
+    return;
+  }
+
+  std::unique_lock<FutureData<T>> g(*data);
+  if (data->state() == FutureData<T>::Waiting) {
+    data->callback =
+      [to](const std::shared_ptr<FutureData<T>>&, T* value, std::exception_ptr* error) {
+        if (value)
+          setValue(to, std::move(*value));
+        else
+          setError(to, std::move(*error));
+      };
+  } else {
+    g.unlock();
+    if (data->state() == FutureData<T>::Value)
+      setValue(to, std::move(data->value()));
+    else
+      setError(to, std::move(data->error()));
   }
-  if (data.callback)
-    data.callback();
 }
 
+// Calls 'done' without arguments in the thread that completes 'future', and
+// returns a future with the same value or error and executor. This is a
+// single link without an executor hop, for bookkeeping that doesn't care
+// about the result.
+template <typename T, typename Done>
+Future<T> onComplete(Future<T>&& future, Done&& done)
+{
+  if constexpr (std::is_void_v<T>) {
+    return FutureAccess::fromBase(
+      onComplete(FutureAccess::base(std::move(future)), std::forward<Done>(done)));
+  } else {
+    std::shared_ptr<FutureData<T>>& data = FutureAccess::data(future);
+    if (data) {
+      std::unique_lock<FutureData<T>> g(*data);
+      if (data->state() == FutureData<T>::Waiting) {
+        auto next = makeShared<FutureData<T>>();
+        next->setExecutor(data->executor());
+        next->inheritSite(*data);
+        data->callback = [next, done = std::forward<Done>(done)](
+                           const std::shared_ptr<FutureData<T>>&,
+                           T* value,
+                           std::exception_ptr* error) mutable {
+          done();
+          if (value)
+            setValue(next, std::move(*value));
+          else
+            setError(next, std::move(*error));
+        };
+        return next;
+      }
+    }
+    done();
+    return std::move(future);
+  }
+}
+
+// Calls 'f' with the value as an rvalue, or as an lvalue if 'f' takes T&
+template <typename Func, typename T>
+decltype(auto) invokeValue(Func& f, T& value)
+{
+  if constexpr (std::is_invocable_v<Func&, T&&>)
+    return std::invoke(f, std::move(value));
+  else
+    return std::invoke(f, value);
+}
+
+// Called with either 'value' or 'error', which are consumed by this call.
 template <typename From, typename To, typename Func>
-inline void handleThenDirect(std::shared_ptr<FutureData<From>>& from,
+inline void handleThenDirect(From* value,
+                             std::exception_ptr* error,
                              std::shared_ptr<FutureData<To>>& to,
                              Func&& f)
 {
-  if (from->value.index() == FutureData<From>::Value) {
+  if (value) {
     try {
-      using FuncRet = typename Type<Func>::Ret;
+      using FuncRet = ThenRet<Func, From>;
       if constexpr (is_specialization_v<FuncRet, Future>) {
-        if constexpr (std::is_same_v<From, void_type>) {
-          f()
-            .then([to](To v) { etValue(*to, std::move(v)); })
-            .error([to](std::exception_ptr error) { setError(*to, std::move(error)); });
-        } else {
-          f(std::move(std::get<FutureData<From>::Value>(from->value)))
-            .then([to](To v) { setValue(*to, std::move(v)); })
-            .error([to](std::exception_ptr error) { setError(*to, std::move(error)); });
-        }
+        if constexpr (std::is_same_v<From, void_type>)
+          splice(std::invoke(f), to);
+        else
+          splice(invokeValue(f, *value), to);
       } else if constexpr (std::is_same_v<From, void_type>) {
         if constexpr (std::is_same_v<To, void_type>) {
-          f();
-          setValue(*to, void_type{});
+          std::invoke(f);
+          setValue(to, void_type{});
         } else {
-          setValue(*to, f());
+          setValue(to, std::invoke(f));
         }
       } else {
         if constexpr (std::is_same_v<To, void_type>) {
-          f(std::move(std::get<FutureData<From>::Value>(from->value)));
-          setValue(*to, void_type{});
+          invokeValue(f, *value);
+          setValue(to, void_type{});
         } else {
-          setValue(*to, f(std::move(std::get<FutureData<From>::Value>(from->value))));
+          setValue(to, invokeValue(f, *value));
         }
       }
     } catch (...) {
-      setError(*to, std::current_exception());
+      setError(to, std::current_exception());
     }
   } else {
-    assert(from->value.index() == FutureData<From>::Error);
-    setError(*to, std::move(std::get<FutureData<From>::Error>(from->value)));
+    setError(to, std::move(*error));
   }
 }
 
 template <typename E, typename T, typename Func>
-inline void handleErrorDirect(std::shared_ptr<FutureData<T>>& from,
+inline void handleErrorDirect(T* value,
+                              std::exception_ptr* error,
                               std::shared_ptr<FutureData<T>>& to,
                               Func&& f)
 {
-  if (from->value.index() == FutureData<T>::Value) {
-    setValue(*to, std::move(std::get<FutureData<T>::Value>(from->value)));
+  if (value) {
+    setValue(to, std::move(*value));
   } else {
-    assert(from->value.index() == FutureData<T>::Error);
-    using FuncRet = typename Type<Func>::Ret;
-
-    if constexpr (std::is_same_v<E, std::exception_ptr>) {
+    if constexpr (std::is_same_v<std::decay_t<E>, std::exception_ptr>) {
+      using FuncRet = std::invoke_result_t<std::decay_t<Func>&, std::exception_ptr&&>;
       try {
         if constexpr (is_specialization_v<FuncRet, Future>) {
-          f(std::move(std::get<FutureData<T>::Error>(from->value)))
-            .then([to](T v) { setValue(*to, std::move(v)); })
-            .error([to](std::exception_ptr error) { setError(*to, std::move(error)); });
+          splice(std::invoke(f, std::move(*error)), to);
         } else if constexpr (std::is_same_v<T, void_type>) {
-          f(std::move(std::get<FutureData<T>::Error>(from->value)));
-          setValue(*to, void_type{});
+          std::invoke(f, std::move(*error));
+          setValue(to, void_type{});
         } else {
-          setValue(*to, f(std::move(std::get<FutureData<T>::Error>(from->value))));
+          setValue(to, std::invoke(f, std::move(*error)));
         }
       } catch (...) {
-        setError(*to, std::current_exception());
+        setError(to, std::current_exception());
       }
     } else {
       using Catch = typename CatchType<E>::Type;
+      using FuncRet = std::invoke_result_t<std::decay_t<Func>&, Catch>;
       try {
-        std::rethrow_exception(std::get<FutureData<T>::Error>(from->value));
+        std::rethrow_exception(*error);
       } catch (Catch e) {
         try {
           if constexpr (is_specialization_v<FuncRet, Future>) {
-            f(e)
-              .then([to](T v) { setValue(*to, std::move(v)); })
-              .error([to](std::exception_ptr error) { setError(*to, std::move(error)); });
+            splice(std::invoke(f, e), to);
           } else if constexpr (std::is_same_v<T, void_type>) {
-            f(e);
-            setValue(*to, void_type{});
+            std::invoke(f, e);
+            setValue(to, void_type{});
           } else {
-            setValue(*to, f(e));
+            setValue(to, std::invoke(f, e));
           }
         } catch (...) {
-          setError(*to, std::current_exception());
+          setError(to, std::current_exception());
         }
       } catch (...) {
-        setError(*to, std::get<FutureData<T>::Error>(from->value));
+        setError(to, std::move(*error));
       }
     }
   }
 }
 
-// Called when from has ready value or an error, and now we are expected to
-// call the continuation function f in the 'from' executor. The result of f
-// is then assigned to 'to'. If 'f' returns a future instead, a new then/error
-// continuations are added to the future which then assign the value to 'to'.
-template <typename From, typename To, typename Func>
-inline void handleThen(std::shared_ptr<FutureData<From>>& from,
+// Selects the executor of a single then() continuation. These are captured
+// by the continuation callbacks, so the two first ones are empty.
+
+// Uses the executor of the future, set with via()
+struct ChainExecutor
+{
+  inline Executor* operator()(Executor* chain) const { return chain; }
+};
+
+// Calls the continuation directly in the thread that completes the future
+struct InlineExecutor
+{
+  inline Executor* operator()(Executor*) const { return nullptr; }
+};
+
+// Overrides the executor for a single continuation
+struct StepExecutor
+{
+  inline Executor* operator()(Executor*) const { return executor; }
+
+  Executor* executor;
+};
+
+// Returns true if a continuation for 'executor' can be called directly in
+// the current thread
+inline bool canRunInline(Executor* executor)
+{
+  return !executor || (t_inlineDepth < MaxInlineDepth && executor->canRunInline());
+}
+
+// Calls 'direct' in the current thread if 'executor' allows it, otherwise
+// 'value' or 'error' is stored to 'from' and 'direct' is called later from
+// the executor.
+//
+// Only a 'handoff' from the producer may skip the executor queue. A
+// continuation added to a future that is already ready is always queued to
+// its executor, otherwise via() and then() called from a worker would run
+// in the calling thread instead of fanning out to the other workers.
+template <typename T, typename Direct>
+inline void dispatch(Executor* executor,
+                     const std::shared_ptr<FutureData<T>>& from,
+                     T* value,
+                     std::exception_ptr* error,
+                     bool handoff,
+                     Direct&& direct)
+{
+  if (!executor) {
+    direct(value, error);
+  } else if (handoff && canRunInline(executor)) {
+    ++t_inlineDepth;
+    direct(value, error);
+    --t_inlineDepth;
+  } else {
+    if (from->state() == FutureData<T>::Waiting)
+      store(*from, value, error);
+    executor->add([from, direct = std::forward<Direct>(direct)]() mutable {
+      if (from->state() == FutureData<T>::Value)
+        direct(&from->value(), nullptr);
+      else
+        direct(nullptr, &from->error());
+    });
+  }
+}
+
+// Called when 'from' has a value or an error, either stored in 'from' or
+// handed directly from the producer. Now we are expected to call the
+// continuation function f in the 'from' executor. The result of f is then
+// assigned to 'to'. If 'f' returns a future instead, it is spliced to 'to'.
+template <typename Step, typename From, typename To, typename Func>
+inline void handleThen(Step step,
+                       const std::shared_ptr<FutureData<From>>& from,
+                       From* value,
+                       std::exception_ptr* error,
+                       bool handoff,
                        std::shared_ptr<FutureData<To>>& to,
                        Func&& f)
 {
-  if (from->executor) {
-    from->executor->add([from, to, f]() mutable { handleThenDirect(from, to, std::move(f)); });
-  } else {
-    handleThenDirect(from, to, std::forward<Func>(f));
+  dispatch(step(from->executor()),
+           from,
+           value,
+           error,
+           handoff,
+           [to, f = std::forward<Func>(f)](From* value, std::exception_ptr* error) mutable {
+             handleThenDirect(value, error, to, std::move(f));
+           });
+}
+
+template <typename E, typename T, typename Func>
+inline void handleError(const std::shared_ptr<FutureData<T>>& from,
+                        T* value,
+                        std::exception_ptr* error,
+                        bool handoff,
+                        std::shared_ptr<FutureData<T>>& to,
+                        Func&& f)
+{
+  dispatch(from->executor(),
+           from,
+           value,
+           error,
+           handoff,
+           [to, f = std::forward<Func>(f)](T* value, std::exception_ptr* error) mutable {
+             handleErrorDirect<E>(value, error, to, std::move(f));
+           });
+}
+
+// Calls 'f' with the value of a ready future that doesn't have shared
+// state, and returns the result as a ready future with 'executor'.
+template <typename Ret, typename T, typename Func>
+FutureType<Ret> thenReady(Executor* executor, T& value, Func& f)
+{
+  auto call = [&]() -> decltype(auto) {
+    if constexpr (std::is_same_v<T, void_type>)
+      return std::invoke(f);
+    else
+      return invokeValue(f, value);
+  };
+
+  try {
+    if constexpr (is_specialization_v<Ret, Future>) {
+      return call().via(executor);
+    } else if constexpr (std::is_void_v<Ret>) {
+      call();
+      return FutureType<Ret>(void_type{}).via(executor);
+    } else {
+      return FutureType<Ret>(call()).via(executor);
+    }
+  } catch (...) {
+    return FutureAccess::readyError<FutureType<Ret>>(std::current_exception(), executor);
   }
 }
 
-template <typename E, typename D, typename Func>
-inline void handleError(D& from, D& to, Func&& f)
+// Calls the error handler 'f' of a ready future that doesn't have shared
+// state, and returns the result as a ready future with 'executor'.
+template <typename E, typename T, typename Func>
+Future<T> errorReady(Executor* executor, std::exception_ptr& error, Func& f)
 {
-  if (from->executor) {
-    from->executor->add([from, to, f]() mutable { handleErrorDirect<E>(from, to, std::move(f)); });
+  auto call = [&](auto&& arg) -> Future<T> {
+    using FuncRet = std::invoke_result_t<Func&, decltype(arg)>;
+    try {
+      if constexpr (is_specialization_v<FuncRet, Future>) {
+        return FutureAccess::base(std::invoke(f, std::forward<decltype(arg)>(arg)).via(executor));
+      } else if constexpr (std::is_same_v<T, void_type>) {
+        std::invoke(f, std::forward<decltype(arg)>(arg));
+        return Future<T>(void_type{}).via(executor);
+      } else {
+        return Future<T>(std::invoke(f, std::forward<decltype(arg)>(arg))).via(executor);
+      }
+    } catch (...) {
+      return FutureAccess::readyError<Future<T>>(std::current_exception(), executor);
+    }
+  };
+
+  if constexpr (std::is_same_v<std::decay_t<E>, std::exception_ptr>) {
+    return call(std::move(error));
   } else {
-    handleErrorDirect<E>(from, to, std::forward<Func>(f));
+    try {
+      std::rethrow_exception(error);
+    } catch (typename CatchType<E>::Type e) {
+      return call(e);
+    } catch (...) {
+      return FutureAccess::readyError<Future<T>>(std::move(error), executor);
+    }
   }
 }
 
+// Returns pointers to the value and error stored in a ready 'data'
+template <typename T>
+inline std::pair<T*, std::exception_ptr*> stored(FutureData<T>& data)
+{
+  if (data.state() == FutureData<T>::Value)
+    return { &data.value(), nullptr };
+  assert(data.state() == FutureData<T>::Error);
+  return { nullptr, &data.error() };
+}
+
 } // namespace Impl
 
 template <typename T>
 template <typename Y>
 FutureData<T>::FutureData(Y&& t)
-  : value(std::forward<Y>(t))
-{}
+{
+  emplaceValue(std::forward<Y>(t));
+}
 
 template <typename T>
 Future<T>::Future(std::shared_ptr<FutureDataType<T>> data)
@@ -162,106 +460,237 @@ Future<T>::Future(std::shared_ptr<FutureDataType<T>> data)
 template <typename T>
 template <typename Y>
 Future<T>::Future(Y&& t)
-  : m_data(std::make_shared<FutureDataType<T>>(std::forward<Y>(t)))
-{}
+{
+  if constexpr (InlineReady)
+    m_ready.template emplace<Impl::ReadyValue>(std::forward<Y>(t));
+  else
+    m_data = Impl::makeShared<FutureDataType<T>>(std::forward<Y>(t));
+}
 
 template <typename T>
 Future<T>&& Future<T>::via(Executor* executor) &&
 {
-  m_data->executor = executor;
+  if (m_data)
+    m_data->setExecutor(executor);
+  else
+    m_executor = executor;
   return std::move(*this);
 }
 
+template <typename T>
+void Future<T>::share()
+{
+  if constexpr (InlineReady) {
+    if (m_ready.index() == Impl::ReadyValue)
+      m_data = Impl::makeShared<FutureDataType<T>>(std::move(std::get<Impl::ReadyValue>(m_ready)));
+  }
+  if (!m_data) {
+    m_data = Impl::makeShared<FutureDataType<T>>();
+    m_data->emplaceError(std::move(std::get<Impl::ReadyError>(m_ready)));
+  }
+  m_data->setExecutor(m_executor);
+  m_ready.template emplace<Impl::ReadyNone>();
+}
+
 template <typename T>
 T Future<T>::get() &&
 {
-  std::unique_lock<std::mutex> lock(m_data->mutex);
+  if (!m_data) {
+    if constexpr (InlineReady) {
+      if (m_ready.index() == Impl::ReadyValue)
+        return std::move(std::get<Impl::ReadyValue>(m_ready));
+    }
+    std::rethrow_exception(std::move(std::get<Impl::ReadyError>(m_ready)));
+  }
+
+  std::unique_lock<FutureDataType<T>> lock(*m_data);
+
+  if (m_data->state() == FutureData<T>::Waiting) {
+    Executor* executor = Executor::current();
+    Executor::BlockingPolicy policy =
+      executor ? executor->blockingPolicy() : Executor::BlockingPolicy::Block;
+    if (policy == Executor::BlockingPolicy::Fail)
+      throw BlockingError("Future::get() called from an executor thread with BlockingPolicy::Fail");
 
-  if (m_data->value.index() == FutureData<T>::Waiting) {
-    std::condition_variable cond;
-    m_data->callback = [&cond] { cond.notify_all(); };
-    while (m_data->value.index() == FutureData<T>::Waiting)
-      cond.wait(lock);
+    std::condition_variable_any cond;
+    Executor* helped = policy == Executor::BlockingPolicy::Help ? executor : nullptr;
+    // Notify while holding the lock, otherwise this function could return
+    // and destroy cond, or the task running it could finish and destroy the
+    // executor, while the notify is still running. The value needs to be
+    // stored, since it's not moved out before this function wakes up.
+    m_data->callback = [&cond, helped](const std::shared_ptr<FutureDataType<T>>& self,
+                                       T* value,
+                                       std::exception_ptr* error) {
+      std::lock_guard<FutureDataType<T>> g(*self);
+      if (value)
+        self->emplaceValue(std::move(*value));
+      else
+        self->emplaceError(std::move(*error));
+      if (helped)
+        helped->wakeHelpers();
+      else
+        cond.notify_all();
+    };
+    if (helped) {
+      lock.unlock();
+      helped->helpUntil([this] {
+        std::lock_guard<FutureDataType<T>> g(*m_data);
+        return m_data->state() != FutureData<T>::Waiting;
+      });
+      lock.lock();
+    } else {
+      while (m_data->state() == FutureData<T>::Waiting)
+        cond.wait(lock);
+    }
   }
 
-  if (m_data->value.index() == FutureData<T>::Value)
-    return std::get<FutureData<T>::Value>(std::move(m_data->value));
+  if (m_data->state() == FutureData<T>::Value)
+    return std::move(m_data->value());
 
-  std::rethrow_exception(std::get<FutureData<T>::Error>(std::move(m_data->value)));
+  std::rethrow_exception(std::move(m_data->error()));
 }
 
 template <typename T>
 bool Future<T>::isReady() const
 {
-  std::unique_lock<std::mutex> g(m_data->mutex);
-  return m_data->value.index() != FutureData<T>::Waiting;
+  if (!m_data)
+    return true;
+  std::unique_lock<FutureDataType<T>> g(*m_data);
+  return m_data->state() != FutureData<T>::Waiting;
 }
 
 template <typename T>
 bool Future<T>::hasValue() const
 {
-  std::unique_lock<std::mutex> g(m_data->mutex);
-  return m_data->value.index() == FutureData<T>::Value;
+  if (!m_data)
+    return m_ready.index() == Impl::ReadyValue;
+  std::unique_lock<FutureDataType<T>> g(*m_data);
+  return m_data->state() == FutureData<T>::Value;
 }
 
 template <typename T>
 bool Future<T>::hasError() const
 {
-  std::unique_lock<std::mutex> g(m_data->mutex);
-  return m_data->value.index() == FutureData<T>::Error;
+  if (!m_data)
+    return m_ready.index() == Impl::ReadyError;
+  std::unique_lock<FutureDataType<T>> g(*m_data);
+  return m_data->state() == FutureData<T>::Error;
 }
 
 template <typename T>
 template <typename F>
 auto Future<T>::error(F&& f) && -> Future<T>
 {
-  using E = typename Type<F>::Arg;
+  using E = ErrorArg<F>;
 
-  std::unique_lock<std::mutex> g(m_data->mutex);
-  size_t idx = m_data->value.index();
+  if (!m_data) {
+    // A ready value passes through as is, keeping its executor
+    if (m_ready.index() != Impl::ReadyError)
+      return std::move(*this);
+    if (!m_executor)
+      return Impl::errorReady<E, T>(m_executor, std::get<Impl::ReadyError>(m_ready), f);
+    // The handler is queued to the executor, which needs shared state
+    share();
+  }
+
+  std::unique_lock<FutureDataType<T>> g(*m_data);
+  auto idx = m_data->state();
   if (idx == FutureData<T>::Waiting) {
-    std::weak_ptr<FutureDataType<T>> selfWeak(m_data);
-    auto next = std::make_shared<FutureDataType<T>>();
-    next->executor = m_data->executor;
-    m_data->callback = [selfWeak, next, f]() mutable {
-      std::shared_ptr<FutureDataType<T>> self(selfWeak);
-      Impl::handleError<E>(self, next, std::forward<F>(f));
+    auto next = Impl::makeShared<FutureDataType<T>>();
+    next->setExecutor(m_data->executor());
+    next->inheritSite(*m_data);
+    m_data->callback = [next, f = std::forward<F>(f)](
+                         const std::shared_ptr<FutureDataType<T>>& self,
+                         T* value,
+                         std::exception_ptr* error) mutable {
+      Impl::handleError<E>(self, value, error, true, next, std::move(f));
     };
     return next;
   } else {
     g.unlock();
-    auto next = std::make_shared<FutureDataType<T>>();
-    next->executor = m_data->executor;
-    Impl::handleError<E>(m_data, next, std::forward<F>(f));
+    auto next = Impl::makeShared<FutureDataType<T>>();
+    next->setExecutor(m_data->executor());
+    auto [value, error] = Impl::stored(*m_data);
+    Impl::handleError<E>(m_data, value, error, false, next, std::forward<F>(f));
     return next;
   }
 }
 
 template <typename T>
 template <typename F>
-auto Future<T>::then(F&& f) && -> FutureType<typename Type<F>::Ret>
+auto Future<T>::then(F&& f) && -> FutureType<ThenRet<F, T>>
+{
+  return std::move(*this).thenStep(Impl::ChainExecutor(), std::forward<F>(f));
+}
+
+template <typename T>
+template <typename F>
+auto Future<T>::thenInline(F&& f) && -> FutureType<ThenRet<F, T>>
 {
-  using Ret = typename Type<F>::Ret;
+  return std::move(*this).thenStep(Impl::InlineExecutor(), std::forward<F>(f));
+}
+
+template <typename T>
+template <typename F>
+auto Future<T>::thenOn(Executor* executor, F&& f) && -> FutureType<ThenRet<F, T>>
+{
+  return std::move(*this).thenStep(Impl::StepExecutor{ executor }, std::forward<F>(f));
+}
+
+template <typename T>
+template <typename Step, typename F>
+auto Future<T>::thenStep(Step step, F&& f) && -> FutureType<ThenRet<F, T>>
+{
+  using Ret = ThenRet<F, T>;
+
+  if (!m_data) {
+    // An error skips the continuation, so nothing needs to be queued
+    if (m_ready.index() == Impl::ReadyError) {
+      return Impl::FutureAccess::readyError<FutureType<Ret>>(
+        std::move(std::get<Impl::ReadyError>(m_ready)), m_executor);
+    }
+    if constexpr (InlineReady) {
+      Executor* executor = step(m_executor);
+      if (!executor)
+        return Impl::thenReady<Ret>(m_executor, std::get<Impl::ReadyValue>(m_ready), f);
+      // Any executor gets the continuation queued, which needs shared state
+      share();
+    }
+  }
 
-  std::unique_lock<std::mutex> g(m_data->mutex);
-  size_t idx = m_data->value.index();
+  std::unique_lock<FutureDataType<T>> g(*m_data);
+  auto idx = m_data->state();
   if (idx == FutureData<T>::Waiting) {
-    std::weak_ptr<FutureDataType<T>> selfWeak(m_data);
-    auto next = std::make_shared<FutureDataType<Ret>>();
-    next->executor = m_data->executor;
-    m_data->callback = [selfWeak, next, f]() mutable {
-      std::shared_ptr<FutureDataType<T>> self(selfWeak);
-      Impl::handleThen(self, next, std::forward<F>(f));
-    };
+    auto next = Impl::makeShared<FutureDataType<Ret>>();
+    next->setExecutor(m_data->executor());
+    next->inheritSite(*m_data);
+    if constexpr (std::is_empty_v<Step>) {
+      // Stateless policies are not captured, even an empty capture takes
+      // space that the continuation needs to fit in the callback
+      m_data->callback = [next, f = std::forward<F>(f)](
+                           const std::shared_ptr<FutureDataType<T>>& self,
+                           T* value,
+                           std::exception_ptr* error) mutable {
+        Impl::handleThen(Step(), self, value, error, true, next, std::move(f));
+      };
+    } else {
+      m_data->callback = [next, step, f = std::forward<F>(f)](
+                           const std::shared_ptr<FutureDataType<T>>& self,
+                           T* value,
+                           std::exception_ptr* error) mutable {
+        Impl::handleThen(step, self, value, error, true, next, std::move(f));
+      };
+    }
     return next;
   } else {
     // value can't be reassigned or cleared, so there's no need to keep
-    // the mutex locked anymore, which also could lead to deadlock
+    // the data locked anymore, which also could lead to deadlock
     // depending on what f does.
     g.unlock();
-    auto next = std::make_shared<FutureDataType<Ret>>();
-    next->executor = m_data->executor;
-    Impl::handleThen(m_data, next, std::forward<F>(f));
+    auto next = Impl::makeShared<FutureDataType<Ret>>();
+    next->setExecutor(m_data->executor());
+    auto [value, error] = Impl::stored(*m_data);
+    Impl::handleThen(step, m_data, value, error, false, next, std::forward<F>(f));
     return next;
   }
 }
@@ -270,10 +699,35 @@ Future<void>::Future(std::shared_ptr<FutureDataType<void>> data)
   : Base(std::move(data))
 {}
 
+inline Future<void>::Future(void_type)
+  : Base(void_type{})
+{}
+
+inline Future<void>::Future(Base&& base)
+  : Base(std::move(base))
+{}
+
 Future<>&& Future<void>::via(Executor* executor) &&
 {
-  m_data->executor = executor;
+  std::move(*this).Base::via(executor);
   return std::move(*this);
 }
 
+template <typename F>
+auto Future<void>::error(F&& f) && -> Future<>
+{
+  return Future<>(std::move(*this).Base::error(std::forward<F>(f)));
+}
+
+template <typename T>
+Future<std::decay_t<T>> makeReadyFuture(T&& value)
+{
+  return Future<std::decay_t<T>>(std::forward<T>(value));
+}
+
+inline Future<> makeReadyFuture()
+{
+  return Future<>(void_type{});
+}
+
 }
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace Pledge {
+namespace Impl {
+
+template <typename Signature, size_t Size>
+class InlineFunction;
+
+// Non-copyable and non-movable replacement for std::function. Callables that
+// fit in 'Size' bytes are stored inline without allocating memory, larger
+// ones are allocated from the heap.
+template <typename R, typename... Args, size_t Size>
+class InlineFunction<R(Args...), Size>
+{
+public:
+  InlineFunction() = default;
+  inline ~InlineFunction() { reset(); }
+
+  InlineFunction(const InlineFunction&) = delete;
+  InlineFunction& operator=(const InlineFunction&) = delete;
+
+  template <typename F>
+  InlineFunction& operator=(F&& f)
+  {
+    using Func = std::decay_t<F>;
+    reset();
+    if constexpr (fitsInline<Func>()) {
+      new (m_storage) Func(std::forward<F>(f));
+      m_ops = &s_inlineOps<Func>;
+    } else {
+      *reinterpret_cast<Func**>(m_storage) = new Func(std::forward<F>(f));
+      m_ops = &s_heapOps<Func>;
+    }
+    return *this;
+  }
+
+  inline explicit operator bool() const { return m_ops != nullptr; }
+
+  inline R operator()(Args... args)
+  {
+    return m_ops->invoke(m_storage, std::forward<Args>(args)...);
+  }
+
+  inline void reset()
+  {
+    if (m_ops) {
+      m_ops->destroy(m_storage);
+      m_ops = nullptr;
+    }
+  }
+
+private:
+  struct Ops
+  {
+    R (*invoke)(void* storage, Args&&... args);
+    void (*destroy)(void* storage);
+  };
+
+  template <typename Func>
+  static constexpr bool fitsInline()
+  {
+    return sizeof(Func) <= Size && alignof(Func) <= alignof(void*);
+  }
+
+  template <typename Func>
+  static constexpr Ops s_inlineOps = {
+    [](void* storage, Args&&... args) -> R {
+      return (*static_cast<Func*>(storage))(std::forward<Args>(args)...);
+    },
+    [](void* storage) { static_cast<Func*>(storage)->~Func(); }
+  };
+
+  template <typename Func>
+  static constexpr Ops s_heapOps = {
+    [](void* storage, Args&&... args) -> R {
+      return (**static_cast<Func**>(storage))(std::forward<Args>(args)...);
+    },
+    [](void* storage) { delete *static_cast<Func**>(storage); }
+  };
+
+  const Ops* m_ops = nullptr;
+  alignas(void*) unsigned char m_storage[Size];
+};
+
+} // namespace Impl
+}
@@ -0,0 +1,308 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace Pledge {
+
+// Statistics of the allocation pool used for the shared future states,
+// see poolStats().
+struct PoolStats
+{
+  // Allocations served from recycled memory
+  size_t hits = 0;
+  // Allocations that needed new memory from the system
+  size_t misses = 0;
+  // Memory owned by the pool, both in use and waiting to be recycled
+  size_t residentBytes = 0;
+};
+
+namespace Impl {
+
+// Recycles memory blocks of small fixed size classes. Each thread has its
+// own free lists which need no locking. When a thread frees more blocks than
+// it allocates, which happens when futures are created in one thread and
+// destroyed in another one, the surplus is moved in batches to a global list
+// where other threads can pick it up from.
+class Pool
+{
+public:
+  static constexpr size_t Granularity = 16;
+  static constexpr size_t MaxSize = 512;
+  static constexpr size_t ClassCount = MaxSize / Granularity;
+  // Number of blocks moved between the thread-local and global lists at once
+  static constexpr size_t BatchSize = 128;
+  // Thread-local list size that triggers moving a batch to the global list
+  static constexpr size_t LocalLimit = 2 * BatchSize;
+  // Max number of batches per size class in the global list, the rest of
+  // the memory is released back to the system
+  static constexpr size_t GlobalLimit = 64;
+
+  static inline void* allocate(size_t size)
+  {
+    if (size > MaxSize)
+      return ::operator new(size);
+
+    size_t cls = sizeClass(size);
+    if (t_destroyed)
+      return allocateGlobal(cls);
+
+    Local& local = Pool::local();
+    FreeList& list = local.lists[cls];
+    if (!list.head && !local.refill(cls))
+      return allocateNew(cls);
+
+    Node* node = list.head;
+    list.head = node->next;
+    --list.count;
+    if (++local.hits == BatchSize)
+      local.flushStats();
+    return node;
+  }
+
+  static inline void deallocate(void* p, size_t size)
+  {
+    if (size > MaxSize) {
+      ::operator delete(p);
+      return;
+    }
+
+    size_t cls = sizeClass(size);
+    Node* node = static_cast<Node*>(p);
+    if (t_destroyed) {
+      node->next = nullptr;
+      global().push(cls, { node, 1 });
+      return;
+    }
+
+    FreeList& list = local().lists[cls];
+    node->next = list.head;
+    list.head = node;
+    if (++list.count >= LocalLimit)
+      global().push(cls, list.take(BatchSize));
+  }
+
+  static inline PoolStats stats()
+  {
+    if (!t_destroyed)
+      local().flushStats();
+
+    Global& g = global();
+    PoolStats stats;
+    stats.hits = g.hits.load(std::memory_order_relaxed);
+    stats.misses = g.misses.load(std::memory_order_relaxed);
+    stats.residentBytes = g.residentBytes.load(std::memory_order_relaxed);
+    return stats;
+  }
+
+private:
+  struct Node
+  {
+    Node* next;
+  };
+
+  struct FreeList
+  {
+    // Detaches up to 'n' blocks from the beginning of the list
+    inline FreeList take(size_t n)
+    {
+      FreeList out{ head, 0 };
+      Node* last = nullptr;
+      while (head && out.count < n) {
+        last = head;
+        head = head->next;
+        ++out.count;
+      }
+      if (last)
+        last->next = nullptr;
+      count -= out.count;
+      return out;
+    }
+
+    Node* head = nullptr;
+    size_t count = 0;
+  };
+
+  struct Global
+  {
+    struct Class
+    {
+      std::mutex mutex;
+      std::vector<FreeList> batches;
+    };
+
+    inline void push(size_t cls, FreeList batch)
+    {
+      {
+        std::lock_guard<std::mutex> g(classes[cls].mutex);
+        if (classes[cls].batches.size() < GlobalLimit) {
+          classes[cls].batches.push_back(batch);
+          return;
+        }
+      }
+      residentBytes.fetch_sub(batch.count * blockSize(cls), std::memory_order_relaxed);
+      while (batch.head) {
+        Node* next = batch.head->next;
+        ::operator delete(batch.head);
+        batch.head = next;
+      }
+    }
+
+    inline bool pop(size_t cls, FreeList& out)
+    {
+      std::lock_guard<std::mutex> g(classes[cls].mutex);
+      if (classes[cls].batches.empty())
+        return false;
+      out = classes[cls].batches.back();
+      classes[cls].batches.pop_back();
+      return true;
+    }
+
+    Class classes[ClassCount];
+    std::atomic<size_t> hits{ 0 };
+    std::atomic<size_t> misses{ 0 };
+    std::atomic<size_t> residentBytes{ 0 };
+  };
+
+  struct Local
+  {
+    inline ~Local()
+    {
+      flushStats();
+      for (size_t cls = 0; cls < ClassCount; ++cls)
+        if (lists[cls].head)
+          global().push(cls, lists[cls]);
+      t_destroyed = true;
+    }
+
+    // Moves a batch from the global list to the empty local list
+    inline bool refill(size_t cls) { return global().pop(cls, lists[cls]); }
+
+    inline void flushStats()
+    {
+      global().hits.fetch_add(hits, std::memory_order_relaxed);
+      hits = 0;
+    }
+
+    FreeList lists[ClassCount];
+    size_t hits = 0;
+  };
+
+  static inline size_t sizeClass(size_t size)
+  {
+    return size == 0 ? 0 : (size - 1) / Granularity;
+  }
+
+  static inline size_t blockSize(size_t cls) { return (cls + 1) * Granularity; }
+
+  // Never destroyed, since blocks can be freed from static destructors
+  static inline Global& global()
+  {
+    static Global* s_global = new Global();
+    return *s_global;
+  }
+
+  static inline void* allocateNew(size_t cls)
+  {
+    Global& g = global();
+    g.misses.fetch_add(1, std::memory_order_relaxed);
+    g.residentBytes.fetch_add(blockSize(cls), std::memory_order_relaxed);
+    return ::operator new(blockSize(cls));
+  }
+
+  // Used after the thread-local lists have been destroyed
+  static inline void* allocateGlobal(size_t cls)
+  {
+    FreeList batch;
+    if (!global().pop(cls, batch))
+      return allocateNew(cls);
+    Node* node = batch.head;
+    batch.head = node->next;
+    --batch.count;
+    if (batch.head)
+      global().push(cls, batch);
+    global().hits.fetch_add(1, std::memory_order_relaxed);
+    return node;
+  }
+
+  static inline Local& local()
+  {
+    static thread_local Local s_local;
+    return s_local;
+  }
+
+  // Trivially destructible, so it can be read even after local() is gone
+  static inline thread_local bool t_destroyed = false;
+};
+
+// Standard allocator interface for the pool, used with std::allocate_shared
+// so that both the object and the shared_ptr control block are recycled.
+template <typename T>
+class PoolAllocator
+{
+public:
+  using value_type = T;
+
+  PoolAllocator() = default;
+
+  template <typename U>
+  PoolAllocator(const PoolAllocator<U>&)
+  {}
+
+  inline T* allocate(size_t n)
+  {
+    if constexpr (alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+      return std::allocator<T>().allocate(n);
+    else
+      return static_cast<T*>(Pool::allocate(n * sizeof(T)));
+  }
+
+  inline void deallocate(T* p, size_t n)
+  {
+    if constexpr (alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+      std::allocator<T>().deallocate(p, n);
+    else
+      Pool::deallocate(p, n * sizeof(T));
+  }
+
+  template <typename U>
+  bool operator==(const PoolAllocator<U>&) const
+  {
+    return true;
+  }
+
+  template <typename U>
+  bool operator!=(const PoolAllocator<U>&) const
+  {
+    return false;
+  }
+};
+
+// Creates a new shared object using the pool. Define PLEDGE_NO_POOL to use
+// std::make_shared instead, for instance to get more accurate reports from
+// memory debugging tools.
+template <typename T, typename... Args>
+std::shared_ptr<T> makeShared(Args&&... args)
+{
+#ifdef PLEDGE_NO_POOL
+  return std::make_shared<T>(std::forward<Args>(args)...);
+#else
+  return std::allocate_shared<T>(PoolAllocator<T>(), std::forward<Args>(args)...);
+#endif
+}
+
+} // namespace Impl
+
+// Returns the pool statistics. Hits from other threads are published in
+// batches, so the value is approximate while other threads are running.
+inline PoolStats poolStats()
+{
+  return Impl::Pool::stats();
+}
+
+}
@@ -1,20 +1,73 @@
 namespace Pledge {
+namespace Impl {
 
+// Called when an unfulfilled promise goes away. Continuations don't keep
+// their own state alive, so the promise may well hold the only reference
+// and the error still has to be delivered to them.
+template <typename T>
+void breakPromise(const std::shared_ptr<FutureData<T>>& data)
+{
+  if (data)
+    setError(data, std::make_exception_ptr(BrokenPromise("Promise destroyed without a value")));
+}
+
+} // namespace Impl
+
+#ifdef PLEDGE_DEBUG_REGISTRY
+template <typename T>
+Promise<T>::Promise(Impl::Site site)
+  : m_data(Impl::makeShared<FutureDataType<T>>())
+{
+  m_data->setSite(site);
+}
+#else
 template <typename T>
 Promise<T>::Promise()
-  : m_data(std::make_shared<FutureDataType<T>>())
+  : m_data(Impl::makeShared<FutureDataType<T>>())
 {}
+#endif
+
+template <typename T>
+Promise<T>::~Promise()
+{
+  if (!m_fulfilled)
+    Impl::breakPromise(m_data);
+}
+
+template <typename T>
+Promise<T>& Promise<T>::operator=(Promise&& other)
+{
+  if (this != &other) {
+    if (!m_fulfilled)
+      Impl::breakPromise(m_data);
+    m_data = std::move(other.m_data);
+    m_fulfilled = other.m_fulfilled;
+  }
+  return *this;
+}
 
+#ifdef PLEDGE_DEBUG_REGISTRY
+template <typename T>
+template <typename Y>
+Promise<T>::Promise(Y&& t, Impl::Site site)
+  : m_data(Impl::makeShared<FutureDataType<T>>(std::forward<Y>(t)))
+  , m_fulfilled(true)
+{
+  m_data->setSite(site);
+}
+#else
 template <typename T>
 template <typename Y>
 Promise<T>::Promise(Y&& t)
-  : m_data(std::make_shared<FutureDataType<T>>(std::forward<Y>(t)))
+  : m_data(Impl::makeShared<FutureDataType<T>>(std::forward<Y>(t)))
+  , m_fulfilled(true)
 {}
+#endif
 
 template <typename T>
 Future<T> Promise<T>::future(Executor* executor)
 {
-  m_data->executor = executor;
+  m_data->setExecutor(executor);
   return Future<T>(m_data);
 }
 
@@ -22,20 +75,23 @@ template <typename T>
 template <typename Y>
 void Promise<T>::setValue(Y&& y)
 {
-  Impl::setValue(*m_data, std::forward<Y>(y));
+  m_fulfilled = true;
+  Impl::setValue(m_data, std::forward<Y>(y));
 }
 
 template <typename T>
 void Promise<T>::setError(std::exception_ptr error)
 {
-  Impl::setError(*m_data, std::move(error));
+  m_fulfilled = true;
+  Impl::setError(m_data, std::move(error));
 }
 
 template <typename T>
 template <typename E>
 void Promise<T>::setError(E&& e)
 {
-  Impl::setError(*m_data, std::make_exception_ptr(std::forward<E>(e)));
+  m_fulfilled = true;
+  Impl::setError(m_data, std::make_exception_ptr(std::forward<E>(e)));
 }
 
 template <typename T>
@@ -49,40 +105,76 @@ void Promise<T>::set(F&& f)
   }
 }
 
+#ifdef PLEDGE_DEBUG_REGISTRY
+Promise<void>::Promise(Impl::Site site)
+  : m_data(Impl::makeShared<FutureData<void_type>>())
+{
+  m_data->setSite(site);
+}
+
+Promise<void>::Promise(void_type t, Impl::Site site)
+  : m_data(Impl::makeShared<FutureData<void_type>>(t))
+  , m_fulfilled(true)
+{
+  m_data->setSite(site);
+}
+#else
 Promise<void>::Promise()
-  : m_data(std::make_shared<FutureData<void_type>>())
+  : m_data(Impl::makeShared<FutureData<void_type>>())
 {}
 
 Promise<void>::Promise(void_type t)
-  : m_data(std::make_shared<FutureData<void_type>>(t))
+  : m_data(Impl::makeShared<FutureData<void_type>>(t))
+  , m_fulfilled(true)
 {}
+#endif
+
+Promise<void>::~Promise()
+{
+  if (!m_fulfilled)
+    Impl::breakPromise(m_data);
+}
+
+Promise<>& Promise<void>::operator=(Promise&& other)
+{
+  if (this != &other) {
+    if (!m_fulfilled)
+      Impl::breakPromise(m_data);
+    m_data = std::move(other.m_data);
+    m_fulfilled = other.m_fulfilled;
+  }
+  return *this;
+}
 
 Future<> Promise<void>::future(Executor* executor)
 {
-  m_data->executor = executor;
+  m_data->setExecutor(executor);
   return Future<>(m_data);
 }
 
 void Promise<void>::setValue()
 {
-  Impl::setValue(*m_data, void_type{});
+  m_fulfilled = true;
+  Impl::setValue(m_data, void_type{});
 }
 
 void Promise<void>::setError(std::exception_ptr error)
 {
-  Impl::setError(*m_data, std::move(error));
+  m_fulfilled = true;
+  Impl::setError(m_data, std::move(error));
 }
 
 template <typename E>
 void Promise<void>::setError(E&& e)
 {
-  Impl::setError(*m_data, std::make_exception_ptr(std::forward<E>(e)));
+  m_fulfilled = true;
+  Impl::setError(m_data, std::make_exception_ptr(std::forward<E>(e)));
 }
 
 template <typename F>
-auto via(Executor* executor, F&& f) -> FutureType<typename Type<F>::Ret>
+auto via(Executor* executor, F&& f) -> FutureType<ThenRet<F, void>>
 {
-  return Promise<>(void_type{}).future(executor).then(std::forward<F>(f));
+  return makeReadyFuture().via(executor).then(std::forward<F>(f));
 }
 
 }
@@ -0,0 +1,238 @@
+#include <cmath>
+#include <random>
+
+namespace Pledge {
+namespace Impl {
+
+// Adds continuations to an attempt 'future'. If it has a value and
+// state->claim() returns true, the value is moved to state->promise.
+// Errors are passed to State::fail.
+template <typename State>
+void settle(const std::shared_ptr<State>& state, FutureType<typename State::ValueType>&& future)
+{
+  using T = typename State::ValueType;
+  if constexpr (std::is_void_v<T>) {
+    std::move(future)
+      .then([state] {
+        if (state->claim())
+          state->promise.setValue();
+      })
+      .error([state](std::exception_ptr error) { State::fail(state, std::move(error)); });
+  } else {
+    std::move(future)
+      .then([state](T v) {
+        if (state->claim())
+          state->promise.setValue(std::move(v));
+      })
+      .error([state](std::exception_ptr error) { State::fail(state, std::move(error)); });
+  }
+}
+
+inline Timer::Clock::duration backoffDelay(const RetryPolicy& policy, size_t attempt)
+{
+  thread_local std::mt19937 s_random{ std::random_device{}() };
+
+  double delay = policy.initialDelay.count() * std::pow(policy.multiplier, attempt - 1);
+  delay = std::min(delay, double(policy.maxDelay.count()));
+  std::uniform_real_distribution<double> jitter(0.0, policy.jitter);
+  delay *= 1.0 - jitter(s_random);
+  return Timer::Clock::duration(Timer::Clock::rep(delay));
+}
+
+template <typename T, typename F>
+struct RetryState
+{
+  using ValueType = T;
+
+  RetryState(Timer* timer, RetryPolicy policy, F factory)
+    : timer(timer)
+    , policy(policy)
+    , factory(std::move(factory))
+  {}
+
+  static void attempt(const std::shared_ptr<RetryState>& self)
+  {
+    ++self->attempts;
+    settle(self, via(nullptr, [self] { return self->factory(); }));
+  }
+
+  // There is only one attempt running at a time
+  bool claim() { return true; }
+
+  static void fail(const std::shared_ptr<RetryState>& self, std::exception_ptr error)
+  {
+    if (self->attempts >= self->policy.maxAttempts) {
+      self->promise.setError(std::move(error));
+      return;
+    }
+    // If the timer is destroyed before the delay, give up with the last error
+    self->timer->after(backoffDelay(self->policy, self->attempts))
+      .then([self] { attempt(self); })
+      .error([self, error](const BrokenPromise&) { self->promise.setError(error); });
+  }
+
+  Timer* timer;
+  RetryPolicy policy;
+  F factory;
+  Promise<T> promise;
+  size_t attempts = 0;
+};
+
+template <typename T, typename F>
+struct HedgeState
+{
+  using ValueType = T;
+
+  HedgeState(F factory)
+    : factory(std::move(factory))
+  {}
+
+  static void attempt(const std::shared_ptr<HedgeState>& self)
+  {
+    settle(self, via(nullptr, [self] { return self->factory(); }));
+  }
+
+  // Schedules the second attempt after 'delay', unless the first one has
+  // already finished
+  static void scheduleHedge(const std::shared_ptr<HedgeState>& self,
+                            Timer* timer,
+                            Timer::Clock::duration delay)
+  {
+    std::lock_guard<std::mutex> g(self->mutex);
+    if (self->done || self->hedged)
+      return;
+    self->timer = timer;
+    self->timerTask = timer->schedule(Timer::Clock::now() + delay, TimerTask(self));
+    self->scheduled = true;
+  }
+
+  // Starts the second attempt unless it's already started or not needed
+  static void startHedge(const std::shared_ptr<HedgeState>& self)
+  {
+    {
+      std::lock_guard<std::mutex> g(self->mutex);
+      if (self->done || self->hedged)
+        return;
+      self->hedged = true;
+    }
+    attempt(self);
+  }
+
+  // Removes the timer task of the second attempt once it's not needed, so
+  // that the task doesn't keep this state alive until the delay
+  void cancelHedge()
+  {
+    Timer::TaskId task;
+    {
+      std::lock_guard<std::mutex> g(mutex);
+      if (!scheduled)
+        return;
+      scheduled = false;
+      task = timerTask;
+    }
+    timer->cancel(task);
+  }
+
+  // Captured by the timer task. The task is destroyed once it has been
+  // called or cancelled, or when the timer is destroyed, and after that
+  // cancelHedge() must not touch the timer.
+  struct TimerTask
+  {
+    TimerTask(std::shared_ptr<HedgeState> self)
+      : self(std::move(self))
+    {}
+
+    TimerTask(const TimerTask&) = default;
+    TimerTask(TimerTask&&) = default;
+
+    ~TimerTask()
+    {
+      if (self) {
+        std::lock_guard<std::mutex> g(self->mutex);
+        self->scheduled = false;
+      }
+    }
+
+    void operator()() { startHedge(self); }
+
+    std::shared_ptr<HedgeState> self;
+  };
+
+  bool claim()
+  {
+    {
+      std::lock_guard<std::mutex> g(mutex);
+      if (done)
+        return false;
+      done = true;
+    }
+    cancelHedge();
+    return true;
+  }
+
+  static void fail(const std::shared_ptr<HedgeState>& self, std::exception_ptr error)
+  {
+    bool last = false;
+    {
+      std::lock_guard<std::mutex> g(self->mutex);
+      if (self->done)
+        return;
+      ++self->failed;
+      if (!self->hedged) {
+        self->hedged = true;
+      } else if (self->failed < 2) {
+        // The other attempt is still running
+        return;
+      } else {
+        self->done = last = true;
+      }
+    }
+    if (last) {
+      self->promise.setError(std::move(error));
+    } else {
+      self->cancelHedge();
+      attempt(self);
+    }
+  }
+
+  F factory;
+  Promise<T> promise;
+  std::mutex mutex;
+  bool done = false;
+  bool hedged = false;
+  int failed = 0;
+  Timer* timer = nullptr;
+  Timer::TaskId timerTask = 0;
+  // The timer task still exists
+  bool scheduled = false;
+};
+
+} // namespace Impl
+
+template <typename F>
+auto retry(Timer* timer, RetryPolicy policy, F&& factory) -> FutureType<ThenRet<F, void>>
+{
+  using T = typename FutureTypeT<ThenRet<F, void>>::FutureValueType;
+  using State = Impl::RetryState<T, std::decay_t<F>>;
+
+  auto state = std::make_shared<State>(timer, policy, std::forward<F>(factory));
+  auto future = state->promise.future();
+  State::attempt(state);
+  return future;
+}
+
+template <typename F>
+auto hedge(Timer* timer, Timer::Clock::duration delay, F&& factory)
+  -> FutureType<ThenRet<F, void>>
+{
+  using T = typename FutureTypeT<ThenRet<F, void>>::FutureValueType;
+  using State = Impl::HedgeState<T, std::decay_t<F>>;
+
+  auto state = std::make_shared<State>(std::forward<F>(factory));
+  auto future = state->promise.future();
+  State::attempt(state);
+  State::scheduleHedge(state, timer, delay);
+  return future;
+}
+
+}
@@ -1,43 +1,108 @@
 #pragma once
 
+#include <exception>
+#include <functional>
+#include <type_traits>
+
 namespace Pledge {
 
+// Type<F> describes the argument and return type of a callable that has
+// exactly one signature: a function, a function pointer or a functor with
+// a single non-template operator(). For other callables, like generic
+// lambdas and std::bind objects, Type<F> is empty.
+template <typename Functor, typename S = void>
+struct Type
+{};
+
 template <typename Functor>
-struct Type : Type<decltype(&Functor::operator())>
+struct Type<Functor, std::void_t<decltype(&Functor::operator())>>
+  : Type<decltype(&Functor::operator())>
 {};
 
-template <typename R, typename C, typename A>
-struct Type<R (C::*)(A) const>
+template <typename R, typename A>
+struct Type<R(A)>
 {
   using Ret = R;
-  using Class = C;
   using Arg = A;
 };
 
-template <typename R, typename C, typename A>
-struct Type<R (C::*)(A)>
+template <typename R>
+struct Type<R()>
 {
   using Ret = R;
+  using Arg = void;
+};
+
+template <typename R, typename A>
+struct Type<R(A) noexcept> : Type<R(A)>
+{};
+
+template <typename R>
+struct Type<R() noexcept> : Type<R()>
+{};
+
+template <typename F>
+struct Type<F*> : Type<F>
+{};
+
+template <typename R, typename C, typename A>
+struct Type<R (C::*)(A) const> : Type<R(A)>
+{
+  using Class = C;
+};
+
+template <typename R, typename C, typename A>
+struct Type<R (C::*)(A)> : Type<R(A)>
+{
   using Class = C;
-  using Arg = A;
 };
 
 template <typename R, typename C>
-struct Type<R (C::*)() const>
+struct Type<R (C::*)() const> : Type<R()>
 {
-  using Ret = R;
   using Class = C;
-  using Arg = void;
 };
 
 template <typename R, typename C>
-struct Type<R (C::*)()>
+struct Type<R (C::*)()> : Type<R()>
 {
-  using Ret = R;
   using Class = C;
-  using Arg = void;
 };
 
+template <typename R, typename C, typename A>
+struct Type<R (C::*)(A) const noexcept> : Type<R (C::*)(A) const>
+{};
+
+template <typename R, typename C, typename A>
+struct Type<R (C::*)(A) noexcept> : Type<R (C::*)(A)>
+{};
+
+template <typename R, typename C>
+struct Type<R (C::*)() const noexcept> : Type<R (C::*)() const>
+{};
+
+template <typename R, typename C>
+struct Type<R (C::*)() noexcept> : Type<R (C::*)()>
+{};
+
+// The argument type of an error() continuation, which selects the exceptions
+// it handles. Callables without a single signature get the std::exception_ptr
+// and handle all errors.
+template <typename F, typename S = void>
+struct ErrorArgT
+{
+  using Type = std::exception_ptr;
+};
+
+template <typename F>
+struct ErrorArgT<F, std::void_t<typename Type<std::decay_t<F>>::Arg>>
+{
+  using Type = typename Pledge::Type<std::decay_t<F>>::Arg;
+};
+
+template <typename F>
+using ErrorArg = typename ErrorArgT<F>::Type;
+
 // is_specialization<std::vector<int>, std::vector>::value == true
 // https://stackoverflow.com/a/28796458
 template <typename Test, template <typename...> class Ref>
@@ -0,0 +1,219 @@
+#include <algorithm>
+#include <mutex>
+#include <optional>
+#include <variant>
+
+namespace Pledge {
+namespace Impl {
+
+template <typename Range, typename F>
+struct WindowState
+{
+  using Types = WindowTypes<Range, F>;
+  using Iterator = typename Types::Iterator;
+  using Value = typename Types::Value;
+  using Result = typename Types::Result;
+  // Something that can be stored in a vector also when f returns void
+  using Stored = std::conditional_t<std::is_void_v<Value>, void_type, Value>;
+  // Either the value or the error of a single item
+  using Outcome = std::variant<Stored, std::exception_ptr>;
+  // Results are put in order through a reorder buffer
+  static constexpr bool Reordered = !std::is_void_v<Value>;
+
+  WindowState(Executor* executor, Range&& range, size_t maxInFlight, F&& f, WindowOrder order)
+    : executor(executor)
+    , range(std::forward<Range>(range))
+    , maxInFlight(std::max<size_t>(maxInFlight, 1))
+    , f(std::forward<F>(f))
+    , order(order)
+    , next(std::begin(this->range))
+  {}
+
+  // Starts items until the window is full. Only one thread launches at a
+  // time, others just ask it to check the window again when they are done.
+  // That also keeps the recursion flat when the items finish inline.
+  static void launch(const std::shared_ptr<WindowState>& self)
+  {
+    std::unique_lock<std::mutex> lock(self->mutex);
+    if (self->launching) {
+      self->relaunch = true;
+      return;
+    }
+    self->launching = true;
+
+    for (;;) {
+      self->relaunch = false;
+      std::vector<Executor::Func> batch;
+      while (!self->error && self->used() < self->maxInFlight &&
+             self->next != std::end(self->range)) {
+        Iterator it = self->next++;
+        size_t index = self->started++;
+        ++self->inFlight;
+        if constexpr (Reordered)
+          if (self->order == WindowOrder::Ordered && self->slots.size() < self->maxInFlight)
+            self->slots.emplace_back();
+        batch.push_back([self, it, index] { run(self, it, index); });
+      }
+
+      if (self->inFlight == 0) {
+        lock.unlock();
+        finish(self);
+        return;
+      }
+
+      lock.unlock();
+      if (!self->executor) {
+        for (Executor::Func& task : batch)
+          task();
+      } else if (batch.size() == 1) {
+        self->executor->add(std::move(batch.front()));
+      } else if (!batch.empty()) {
+        self->executor->addBatch(std::move(batch));
+      }
+      lock.lock();
+
+      if (!self->relaunch) {
+        self->launching = false;
+        return;
+      }
+    }
+  }
+
+  // Calls f for one item and settles it exactly once. The bookkeeping is
+  // kept out of the try blocks, so that an exception from it isn't taken
+  // as a failure of the item.
+  static void run(const std::shared_ptr<WindowState>& self, Iterator it, size_t index)
+  {
+    using Ret = std::invoke_result_t<std::decay_t<F>&, typename Types::Item>;
+    if constexpr (is_specialization_v<Ret, Future>) {
+      std::optional<Ret> future;
+      try {
+        future.emplace(std::invoke(self->f, *it));
+      } catch (...) {
+        settle(self, index, Outcome(std::in_place_index<1>, std::current_exception()));
+        return;
+      }
+      auto failed = [](std::exception_ptr error) {
+        return Outcome(std::in_place_index<1>, std::move(error));
+      };
+      auto done = [self, index](Outcome outcome) { settle(self, index, std::move(outcome)); };
+      if constexpr (std::is_void_v<Value>) {
+        std::move(*future)
+          .thenInline([] { return Outcome(std::in_place_index<0>); })
+          .error(failed)
+          .thenInline(done);
+      } else {
+        std::move(*future)
+          .thenInline([](Value v) { return Outcome(std::in_place_index<0>, std::move(v)); })
+          .error(failed)
+          .thenInline(done);
+      }
+    } else {
+      auto outcome = [&]() -> Outcome {
+        try {
+          if constexpr (std::is_void_v<Value>) {
+            std::invoke(self->f, *it);
+            return Outcome(std::in_place_index<0>);
+          } else {
+            return Outcome(std::in_place_index<0>, std::invoke(self->f, *it));
+          }
+        } catch (...) {
+          return Outcome(std::in_place_index<1>, std::current_exception());
+        }
+      };
+      settle(self, index, outcome());
+    }
+  }
+
+  static void settle(const std::shared_ptr<WindowState>& self, size_t index, Outcome outcome)
+  {
+    {
+      std::lock_guard<std::mutex> g(self->mutex);
+      if (outcome.index() == 1) {
+        if (!self->error)
+          self->error = std::move(std::get<1>(outcome));
+      } else if constexpr (Reordered) {
+        if (self->order == WindowOrder::Ordered)
+          self->reorder(index, std::move(std::get<0>(outcome)));
+        else
+          self->results.push_back(std::move(std::get<0>(outcome)));
+      }
+      --self->inFlight;
+    }
+    launch(self);
+  }
+
+  // Stores the value of item 'index' and moves the values that are now in
+  // order to the results. Called with the mutex locked.
+  void reorder(size_t index, Stored value)
+  {
+    slots[index % maxInFlight].emplace(std::move(value));
+    for (;;) {
+      std::optional<Stored>& slot = slots[flushed % maxInFlight];
+      if (!slot)
+        break;
+      results.push_back(std::move(*slot));
+      slot.reset();
+      ++flushed;
+    }
+  }
+
+  // Items that take a place in the window. In order, a finished item keeps
+  // its place until the earlier ones have finished.
+  size_t used() const
+  {
+    if (Reordered && order == WindowOrder::Ordered)
+      return started - flushed;
+    return inFlight;
+  }
+
+  // Called once, when nothing is in flight and nothing more will be started
+  static void finish(const std::shared_ptr<WindowState>& self)
+  {
+    if (self->error) {
+      self->promise.setError(self->error);
+    } else if constexpr (std::is_void_v<Value>) {
+      self->promise.setValue();
+    } else {
+      self->slots.clear();
+      self->promise.setValue(std::move(self->results));
+    }
+  }
+
+  Executor* executor;
+  Range range;
+  size_t maxInFlight;
+  std::decay_t<F> f;
+  WindowOrder order;
+  Promise<Result> promise;
+
+  std::mutex mutex;
+  Iterator next;
+  size_t started = 0;
+  size_t inFlight = 0;
+  // Number of ordered results moved out of the reorder buffer
+  size_t flushed = 0;
+  bool launching = false;
+  bool relaunch = false;
+  std::exception_ptr error;
+  // Reorder buffer, indexed by the item index modulo maxInFlight
+  std::vector<std::optional<Stored>> slots;
+  std::vector<Stored> results;
+};
+
+} // namespace Impl
+
+template <typename Range, typename F>
+auto window(Executor* executor, Range&& range, size_t maxInFlight, F&& f, WindowOrder order)
+  -> FutureType<typename Impl::WindowTypes<Range, F>::Result>
+{
+  using State = Impl::WindowState<Range, F>;
+
+  auto state = std::make_shared<State>(
+    executor, std::forward<Range>(range), maxInFlight, std::forward<F>(f), order);
+  auto future = state->promise.future();
+  State::launch(state);
+  return future;
+}
+
+}